@@ -0,0 +1,36 @@
+#!/bin/python3
+import subprocess
+import sys
+
+from tabulate import tabulate
+
+if len(sys.argv) < 4:
+    print("Usage: benchmark_knn.py <ballQuery> <tree-file> <query-file> [k ...]")
+    exit(1)
+
+executable = str(sys.argv[1])
+tree_file = str(sys.argv[2])
+query_file = str(sys.argv[3])
+ks = [int(k) for k in sys.argv[4:]] or [1, 2, 5, 10, 20]
+
+
+def run_queries(flags: list):
+    # ballQuery reports "<n> queries in <t> s (<q> queries/s, <n> threads, <v> nodes visited per query)" to stderr
+    result = subprocess.run([executable, tree_file, *flags, "--batch", query_file],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True)
+    queries_per_second = float(result.stderr.decode().split('(')[1].split()[0])
+    return queries_per_second, result.stdout.splitlines()
+
+
+table = []
+for k in ks:
+    heap_rate, heap_answers = run_queries(["-k", str(k)])
+    passes_rate, passes_answers = run_queries(["-k", str(k), "--knn-by-passes"])
+    different = sum(a != b for a, b in zip(heap_answers, passes_answers)) + abs(len(heap_answers) - len(passes_answers))
+    table.append([k, f"{heap_rate:.0f}", f"{passes_rate:.0f}", f"{heap_rate / passes_rate:.2f}", different])
+    print('.', end='', flush=True)
+print()
+
+headers = ["k", "heap (queries/s)", "k passes (queries/s)", "speedup", "different lines"]
+
+print(tabulate(table, headers=headers, tablefmt="github"))
@@ -0,0 +1,41 @@
+#!/bin/python3
+import subprocess
+import sys
+
+from tabulate import tabulate
+
+if len(sys.argv) < 2:
+    print("Usage: benchmark_layouts.py <executable> [repetitions]")
+    exit(1)
+
+executable = str(sys.argv[1])
+repetitions = int(sys.argv[2]) if len(sys.argv) > 2 else 3
+
+layouts = ["aos", "soa"]
+
+alg_args = ['2 5000000 0',
+            '3 5000000 0',
+            '4 5000000 0',
+            '8 2000000 0',
+            '20 1000000 0',
+            '50 500000 0'
+            ]
+
+
+def run_time(layout: str, arg: str) -> float:
+    # ballAlg prints the construction time to stderr, the tree itself is discarded
+    result = subprocess.run([executable, "--layout", layout, *arg.split(' ')],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, check=True)
+    return float(result.stderr.decode().split()[-1])
+
+
+table = []
+for arg in alg_args:
+    times = [min(run_time(layout, arg) for _ in range(repetitions)) for layout in layouts]
+    table.append([arg, *times, f"{times[0] / times[1]:.2f}"])
+    print('.', end='', flush=True)
+print()
+
+headers = ["Arguments", *layouts, "aos/soa"]
+
+print(tabulate(table, headers=headers, tablefmt="github"))
@@ -0,0 +1,51 @@
+#!/bin/python3
+import os
+import subprocess
+import sys
+import tempfile
+
+from tabulate import tabulate
+
+if len(sys.argv) < 4:
+    print("Usage: benchmark_leaf_size.py <bin-dir> <ballAlg arguments> <query-file> [leaf size ...]")
+    exit(1)
+
+bin_dir = str(sys.argv[1])
+alg_args = str(sys.argv[2]).split(' ')
+query_file = str(sys.argv[3])
+leaf_sizes = [int(k) for k in sys.argv[4:]] or [1, 8, 16, 32, 64]
+
+tree_file = os.path.join(tempfile.mkdtemp(), "tree.bin")
+
+
+def build(leaf_size: int) -> float:
+    # ballAlg prints the construction time to stderr
+    with open(tree_file, "wb") as tree:
+        result = subprocess.run([os.path.join(bin_dir, "ballAlg"), "--leaf-size", str(leaf_size), "--format", "binary", *alg_args],
+                                stdout=tree, stderr=subprocess.PIPE, check=True)
+    return float(result.stderr.decode().split()[-1])
+
+
+def query():
+    # ballQuery reports "<n> queries in <t> s (<q> queries/s, <n> threads, <v> nodes visited per query)" to stderr
+    result = subprocess.run([os.path.join(bin_dir, "ballQuery"), tree_file, "--batch", query_file],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True)
+    report = result.stderr.decode().split('(')[1].split()
+    return float(report[0]), float(report[4]), result.stdout
+
+
+table = []
+reference = None
+for leaf_size in leaf_sizes:
+    build_time = build(leaf_size)
+    tree_size = os.path.getsize(tree_file)
+    queries_per_second, visits, answers = query()
+    reference = reference if reference is not None else answers
+    table.append([leaf_size, build_time, f"{tree_size / 2 ** 20:.1f}", f"{queries_per_second:.0f}", visits, answers == reference])
+    print('.', end='', flush=True)
+print()
+os.remove(tree_file)
+
+headers = ["leaf size", "build (s)", "tree file (MiB)", "queries/s", "nodes visited per query", "same answers"]
+
+print(tabulate(table, headers=headers, tablefmt="github"))
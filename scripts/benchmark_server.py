@@ -0,0 +1,74 @@
+#!/bin/python3
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+from tabulate import tabulate
+
+if len(sys.argv) < 4:
+    print("Usage: benchmark_server.py <ballQuery> <tree-file> <query-file> [n_queries]")
+    exit(1)
+
+executable = str(sys.argv[1])
+tree_file = str(sys.argv[2])
+query_file = str(sys.argv[3])
+n_queries = int(sys.argv[4]) if len(sys.argv) > 4 else 200
+
+queries = [line.split() for line in open(query_file) if line.strip()][:n_queries]
+
+
+def percentile(latencies: list, p: float):
+    ordered = sorted(latencies)
+    return ordered[max(0, int(len(ordered) * p / 100.0 + 0.5) - 1)]
+
+
+def row(mode: str, elapsed: float, latencies: list):
+    return [mode, f"{len(latencies) / elapsed:.0f}", f"{1e6 * percentile(latencies, 50):.0f}",
+            f"{1e6 * percentile(latencies, 99):.0f}"]
+
+
+def fork_per_query():
+    # one ballQuery process per query, loading the tree every time
+    latencies = []
+    start = time.time()
+    for query in queries:
+        sent = time.time()
+        subprocess.run([executable, tree_file, *query], stdout=subprocess.DEVNULL, check=True)
+        latencies.append(time.time() - sent)
+    return row("fork per query", time.time() - start, latencies)
+
+
+def server():
+    # one ballQuery --serve process, the tree is loaded once and queries are sent one at a time over the socket
+    path = os.path.join(tempfile.mkdtemp(), "ballQuery.sock")
+    process = subprocess.Popen([executable, tree_file, "--serve", path], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    process.stderr.readline()  # "Serving ..." once the tree is loaded
+    connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    connection.connect(path)
+    stream = connection.makefile("rw")
+
+    latencies = []
+    start = time.time()
+    for query in queries:
+        sent = time.time()
+        stream.write(" ".join(query) + "\n")
+        stream.flush()
+        while stream.readline() not in ("\n", ""):  # replies end with an empty line
+            pass
+        latencies.append(time.time() - sent)
+    table_row = row("server", time.time() - start, latencies)
+
+    connection.close()
+    process.terminate()
+    process.wait()
+    return table_row
+
+
+table = [fork_per_query(), server()]
+
+headers = ["mode", "queries/s", "p50 latency (us)", "p99 latency (us)"]
+
+print(tabulate(table, headers=headers, tablefmt="github"))
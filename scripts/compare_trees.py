@@ -0,0 +1,86 @@
+#!/bin/python3
+import math
+import sys
+
+from tabulate import tabulate
+
+if len(sys.argv) < 3:
+    print("Usage: compare_trees.py <reference-tree-file> <tree-file> [tolerance]")
+    print("Reports how far a tree (e.g. built with make PRECISION=float) diverges from a reference tree of the same dataset")
+    exit(1)
+
+reference_file = str(sys.argv[1])
+tree_file = str(sys.argv[2])
+tolerance = float(sys.argv[3]) if len(sys.argv) > 3 else 1e-4
+
+
+def read_tree(path: str):
+    # Returns the number of dimensions and a map from node id to (is leaf, radius, center)
+    nodes = {}
+    with open(path, 'r') as f:
+        n_dims, n_nodes = map(int, f.readline().split())
+        for line in f:
+            fields = line.split()
+            nodes[int(fields[0])] = (fields[1] == '-1', float(fields[3]), [float(c) for c in fields[4:4 + n_dims]])
+    if len(nodes) != n_nodes:
+        print(f"{path}: header has {n_nodes} nodes but {len(nodes)} were read")
+    return n_dims, nodes
+
+
+def depth(node_id: int) -> int:
+    return int(math.log2(node_id + 1))
+
+
+reference_dims, reference = read_tree(reference_file)
+tree_dims, tree = read_tree(tree_file)
+
+if reference_dims != tree_dims:
+    print(f"Trees have different dimensions ({reference_dims} and {tree_dims})")
+    exit(2)
+
+common = [node_id for node_id in reference if node_id in tree]
+
+max_center_error = 0.0
+sum_center_error = 0.0
+max_radius_error = 0.0
+max_radius_relative_error = 0.0
+n_divergent_nodes = 0
+n_divergent_leaves = 0
+n_leaves = 0
+first_divergent_depth = None
+
+for node_id in common:
+    reference_leaf, reference_radius, reference_center = reference[node_id]
+    leaf, radius, center = tree[node_id]
+
+    center_error = max(abs(r - c) for r, c in zip(reference_center, center))
+    radius_error = abs(reference_radius - radius)
+
+    max_center_error = max(max_center_error, center_error)
+    sum_center_error += center_error
+    max_radius_error = max(max_radius_error, radius_error)
+    if reference_radius > 0:
+        max_radius_relative_error = max(max_radius_relative_error, radius_error / reference_radius)
+
+    n_leaves += reference_leaf
+    if center_error > tolerance or reference_leaf != leaf:
+        # the node holds a different set of points or a different split
+        n_divergent_nodes += 1
+        n_divergent_leaves += reference_leaf
+        if first_divergent_depth is None or depth(node_id) < first_divergent_depth:
+            first_divergent_depth = depth(node_id)
+
+table = [
+    ["Nodes in both trees", len(common)],
+    ["Nodes only in the reference", len(reference) - len(common)],
+    ["Nodes only in the tree", len(tree) - len(common)],
+    ["Max center error", f"{max_center_error:.3e}"],
+    ["Mean center error", f"{sum_center_error / max(len(common), 1):.3e}"],
+    ["Max radius error", f"{max_radius_error:.3e}"],
+    ["Max relative radius error", f"{max_radius_relative_error:.3e}"],
+    [f"Nodes with center error above {tolerance:g}", n_divergent_nodes],
+    [f"Leaves with another point", f"{n_divergent_leaves} of {n_leaves}"],
+    ["Shallowest divergent depth", "-" if first_divergent_depth is None else first_divergent_depth],
+]
+
+print(tabulate(table, headers=["Metric", "Value"], tablefmt="github"))
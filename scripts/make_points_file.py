@@ -0,0 +1,48 @@
+#!/bin/python3
+import array
+import ctypes
+import struct
+import sys
+
+# Layout of struct points_file_header in src/points_format.h, in the byte order of this machine
+HEADER = struct.Struct("=8siiqq")
+MAGIC = b"BALLPNTS"
+VERSION = 1
+RANGE = 10
+RAND_MAX = 2 ** 31 - 1
+
+if len(sys.argv) not in (4, 5) or sys.argv[1] not in ("--generate", "--convert"):
+    print("Usage: make_points_file.py --generate \"<n_dims> <n_points> <seed>\" <points-file> [float]")
+    print("       make_points_file.py --convert <text-file> <points-file> [float]")
+    print("Writes a binary points file for the builders' --input: the points ballAlg generates from <n_dims> <n_points> <seed>,")
+    print("or those of a text file with one point per line")
+    exit(1)
+
+
+def generate(arguments: str):
+    # Draws the coordinates as gen_points.c does, with the random() of the C library
+    n_dims, n_points, seed = map(int, arguments.split())
+    libc = ctypes.CDLL(None)
+    libc.random.restype = ctypes.c_long
+    libc.srandom(ctypes.c_uint(seed))
+    return n_dims, n_points, (RANGE * float(libc.random()) / RAND_MAX for _ in range(n_dims * n_points))
+
+
+def convert(path: str):
+    with open(path, 'r') as f:
+        points = [[float(c) for c in line.split()] for line in f if line.strip()]
+    n_dims = len(points[0])
+    if any(len(p) != n_dims for p in points):
+        print(f"{path}: the points do not all have {n_dims} coordinates")
+        exit(2)
+    return n_dims, len(points), (c for p in points for c in p)
+
+
+args = sys.argv[1:]
+single = len(args) == 4 and args[3] == "float"
+n_dims, n_points, coords = generate(args[1]) if args[0] == "--generate" else convert(args[1])
+values = array.array('f' if single else 'd', coords)
+
+with open(args[2], "wb") as out:
+    out.write(HEADER.pack(MAGIC, VERSION, values.itemsize, n_dims, n_points))
+    values.tofile(out)
@@ -19,7 +19,11 @@ alg_args = ['2 5 0',
             '3 5000000 0',
             '4 10000000 0',
             '3 20000000 0',
-            '4 20000000 0'
+            '4 20000000 0',
+            '--leaf-size 5000000 3 5000000 0',
+            '--leaf-size 3000000 3 5000000 0',
+            '--input trees/duplicates.pts',
+            '--memory-budget 1 --input trees/duplicates.pts'
             ]
 
 query_args = ['3 1',
@@ -31,7 +35,11 @@ query_args = ['3 1',
               '4 5 6',
               '2 4 6 8',
               '1 5 9',
-              '8 6 4 2'
+              '8 6 4 2',
+              '4 5 6',
+              '4 5 6',
+              '4.1 5.2 6.3',
+              '4.1 5.2 6.3'
               ]
 
 query_outputs = [b'2.777747 5.539700',
@@ -43,10 +51,14 @@ query_outputs = [b'2.777747 5.539700',
                 b'3.979046 5.032039 6.011886',
                 b'1.996719 4.012344 5.988101 8.081113',
                 b'1.003042 4.986528 9.010856',
-                b'7.939939 5.934679 3.951869 1.930474'
+                b'7.939939 5.934679 3.951869 1.930474',
+                b'3.979046 5.032039 6.011886',
+                b'3.979046 5.032039 6.011886',
+                b'4.000000 5.000000 6.666667',
+                b'4.000000 5.000000 6.666667'
                 ]
 
-tree_files = ['./trees/ex-' + arg.replace(' ', '-') + '.tree' for arg in alg_args]
+tree_files = ['./trees/ex-' + arg.replace(' ', '-').replace('/', '-') + '.tree' for arg in alg_args]
 
 alg_args = [arg.split(' ') for arg in alg_args]
 
@@ -55,6 +67,12 @@ query_args = [[tree, *arg.split(' ')] for tree, arg in zip(tree_files, query_arg
 if not os.path.exists('trees'):
     os.makedirs('trees')
 
+# 200000 points that are 600 distinct points repeated, so many of them project onto the median of their nodes
+with open('trees/duplicates.txt', 'w') as f:
+    for i in range(200000):
+        f.write(f'{i * 7 % 50 / 5} {i * 11 % 40 / 4} {i * 13 % 30 / 3}\n')
+subprocess.run([sys.executable, 'make_points_file.py', '--convert', 'trees/duplicates.txt', 'trees/duplicates.pts'])
+
 for alg_arg, tree_file, query_arg, expected_out in zip(alg_args, tree_files, query_args, query_outputs):
     with open(tree_file, 'w+') as tree_fd:
         subprocess.run([executable, *alg_arg], stdout=tree_fd, stderr=subprocess.DEVNULL)
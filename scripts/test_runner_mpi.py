@@ -30,7 +30,9 @@ alg_args = ['2 5 0',
             '3 5000000 0',
             '4 10000000 0',
             '3 20000000 0',
-            '4 20000000 0'
+            '4 20000000 0',
+            '--leaf-size 5000000 3 5000000 0',
+            '--leaf-size 3000000 3 5000000 0'
             ]
 
 query_args = ['3 1',
@@ -42,7 +44,9 @@ query_args = ['3 1',
               '4 5 6',
               '2 4 6 8',
               '1 5 9',
-              '8 6 4 2'
+              '8 6 4 2',
+              '4 5 6',
+              '4 5 6'
               ]
 
 query_outputs = [b'2.777747 5.539700',
@@ -54,7 +58,9 @@ query_outputs = [b'2.777747 5.539700',
                 b'3.979046 5.032039 6.011886',
                 b'1.996719 4.012344 5.988101 8.081113',
                 b'1.003042 4.986528 9.010856',
-                b'7.939939 5.934679 3.951869 1.930474'
+                b'7.939939 5.934679 3.951869 1.930474',
+                b'3.979046 5.032039 6.011886',
+                b'3.979046 5.032039 6.011886'
                 ]
 
 tree_files = ['./trees/ex-' + arg.replace(' ', '-') + '.tree' for arg in alg_args]
@@ -4,45 +4,55 @@
 #include <math.h>
 #include <string.h>
 #include <mpi.h>
-#include <unistd.h>
 #include "gen_points_mpi.h"
 #include "point_operations.h"
 #include "ball_tree.h"
+#include "build_tree.h"
+#include "point_kernels.h"
+#include "options.h"
 #include "macros.h"
 #include "get_center_mpi.h"
 #include "point_utils_mpi.h"
 
 int n_dims;                             /* number of dimensions of each point                                               */
 
-double **pts;                           /* list of points of the current iteration of the algorithm                         */
-double **ortho_array;                   /* list of ortogonal projections of the points in pts                               */
-double **ortho_array_srt;               /* list of ortogonal projections of the point in pts to be sorted.                  */
-double **pts_aux;                       /* list of points of the next iteration of the algorithm                            */
+coord_t **pts;                          /* list of points of the current iteration of the algorithm                         */
+double *ortho_array;                    /* list of projection parameters of the points in pts onto the line defined by a, b */
+double *ortho_array_srt;                /* list of projection parameters of the points in pts to be reordered or sorted     */
+coord_t **pts_aux;                      /* list of points of the next iteration of the algorithm                            */
 
 long n_points_local;                    /* number of points in the dataset present at this process                          */
 long n_points_global;                   /* number of points in the dataset present at all processes                         */
 
-double  *basub;                         /* point containing b-a for the orthogonal projections                              */
-double *ortho_tmp;                      /* temporary pointer used for calculation the orthogonal projection                 */
+coord_t *basub;                         /* point containing b-a for the orthogonal projections                              */
+coord_t *ortho_tmp;                     /* temporary pointer used for calculation the orthogonal projection                 */
 
 node_ptr node_list;                     /* list of nodes of the ball tree                                                   */
-double** node_centers;                  /* list of centers of the ball tree nodes                                           */
+coord_t** node_centers;                 /* list of centers of the ball tree nodes                                           */
 
 long n_nodes;                           /* number of nodes of the ball tree                                                 */
 long node_id;                           /* id of the current node of the algorithm                                          */
 long node_counter;                      /* number of nodes generated by the current process                                 */
 
+coord_t** leaf_points;                  /* points of the bucket leaves of the current process, with --leaf-size above 1     */
+long leaf_point_counter;                /* number of points in leaf_points                                                  */
+long leaf_points_offset;                /* index in the whole tree of the first point in leaf_points                        */
+long n_leaf_points;                     /* number of points in the bucket leaves of all processes                           */
+
+MPI_File tree_file;                     /* file of --output, MPI_FILE_NULL when the tree is printed to stdout               */
+MPI_Offset tree_file_offset;            /* bytes of the tree written so far by all processes                                */
+
 long *processes_n_points;               /* array of the number of points owned by each process currently                    */
 
-double **furthest_away_point_buffer;    /* buffer storing the local furthest away point at each process                     */
+coord_t **furthest_away_point_buffer;    /* buffer storing the local furthest away point at each process                     */
 
-double *first_point;                    /* first point in the set i.e. with lower index relative to the initial point set   */
-double *a;                              /* furthest away point from the first point in the globalset                        */
-double *b;                              /* furthest away point from a in the global set                                     */
-double *furthest_from_center;           /* furthest away point from center in the global set                                */
+coord_t *first_point;                   /* first point in the set i.e. with lower index relative to the initial point set   */
+coord_t *a;                             /* furthest away point from the first point in the globalset                        */
+coord_t *b;                             /* furthest away point from a in the global set                                     */
+coord_t *furthest_from_center;          /* furthest away point from center in the global set                                */
 
-double *median_left_point;              /* rightmost point in the global point set that is left of the median               */
-double *median_right_point;             /* leftmost point in the global point set that is right of the median               */
+coord_t *median_left_point;             /* projection of the rightmost point in the global point set left of the median     */
+coord_t *median_right_point;            /* projection of the leftmost point in the global point set right of the median     */
 
 MPI_Comm communicator;                  /* current communicator, includes all processes of the current team                 */
 MPI_Group group;                        /* current group, includes all processes of the current team                        */
@@ -50,147 +60,10 @@ MPI_Group group;                        /* current group, includes all processes
 int rank;                               /* rank of the current process in the current team                                  */
 int n_procs;                            /* total number of processes in the current team                                    */
 
-/***********************************************************************************************************************************************/
-/***********************************************************************************************************************************************/
-/************* Serial Implementation. Used when the number of processes of the current team is one to avoid overhead of mpi calls **************/
-/***********************************************************************************************************************************************/
-/***********************************************************************************************************************************************/
-
-/*
-Returns the point in pts furthest away from point p
-*/
-double* get_furthest_away_point(double* p) {
-    double max_distance = 0.0;
-    double* furthest_point = p;
-    for(long i = 0; i < n_points_local; i++){
-        double curr_distance = distance(p, pts[i]);
-        if(curr_distance > max_distance){
-            max_distance = curr_distance;
-            furthest_point = pts[i];
-        }
-    }
-    return furthest_point;
-}
-
-/*
-Returns the radius of the ball tree node defined by point center
-*/
-double get_radius(double* center) {
-    double* a = get_furthest_away_point(center);
-    return sqrt(distance(a, center));
-}
-
-/*
-Returns the median projection of the dataset
-by sorting the projections based on their x coordinate
-*/
-double* get_center() {
-    memcpy(ortho_array_srt, ortho_array, sizeof(double*) * n_points_local);
-    qsort(ortho_array_srt, n_points_local, sizeof(double*), compare_point);
-
-    if(n_points_local % 2) {
-        /* is odd */
-        long middle = (n_points_local - 1) / 2;
-        copy_point(ortho_array_srt[middle], node_centers[node_counter]);
-    }
-    else {
-        /* is even */
-        long first_middle = (n_points_local / 2) - 1;
-        long second_middle = (n_points_local / 2);
-
-        middle_point(ortho_array_srt[first_middle], ortho_array_srt[second_middle], node_centers[node_counter]);
-    }
-    return node_centers[node_counter];
-}
-
-/*
-Computes the orthogonal projections of points in pts onto line defined by b-a
-*/
-void calc_orthogonal_projections(double* a, double* b) {
-    sub_points(b, a, basub);
-    for(long i = 0; i < n_points_local; i++){
-        orthogonal_projection(basub, a, pts[i], ortho_array[i], ortho_tmp);
-    }
-}
-
-/*
-Places each point in pts in partition left or right by comparing the x coordinate
-of its orthogonal projection with the x coordinate of the center point
-*/
-void fill_partitions(double** left, double** right, double* center) {
-    long l = 0;
-    long r = 0;
-    for(long i = 0; i < n_points_local; i++) {
-        if(ortho_array[i][0] < center[0]) {
-            copy_point(pts[i], left[l]);
-            l++;
-        }
-        else {
-            copy_point(pts[i], right[r]);
-            r++;
-        }
-    }
-}
-
-void build_tree() {
-    if(n_points_local == 1) {
-        copy_point(pts[0], node_centers[node_counter]);
-        make_node(node_id, node_centers[node_counter], 0, &node_list[node_counter]);
-        node_counter++;
-        return;
-    }
-
-    double* a = get_furthest_away_point(pts[0]);
-    double* b = get_furthest_away_point(a);
-
-    calc_orthogonal_projections(a, b);
-
-    double* center = get_center();
-    double radius = get_radius(center);
-
-    node_ptr node = make_node(node_id, center, radius, &node_list[node_counter]);
-    node_counter++;
-
-    double **left = pts_aux;
-    double **pts_aux_left = pts;
-    double **ortho_array_left = ortho_array;
-    double **ortho_array_srt_left = ortho_array_srt;
-    long n_points_left = LEFT_PARTITION_SIZE(n_points_local);
-
-    double **right = pts_aux + n_points_left;
-    double **pts_aux_right = pts + n_points_left;
-    double **ortho_array_right = ortho_array + n_points_left;
-    double **ortho_array_srt_right = ortho_array_srt + n_points_left;
-    long n_points_right = RIGHT_PARTITION_SIZE(n_points_local);
-
-    long node_id_left = 2 * node_id + 1;
-    long node_id_right = 2 * node_id + 2;
-
-    fill_partitions(left, right, center);
-
-    pts = left;
-    pts_aux = pts_aux_left;
-    ortho_array = ortho_array_left;
-    ortho_array_srt = ortho_array_srt_left;
-    n_points_local = n_points_left;
-    node_id = node_id_left;
-    build_tree();
-
-    pts = right;
-    pts_aux = pts_aux_right;
-    ortho_array = ortho_array_right;
-    ortho_array_srt = ortho_array_srt_right;
-    n_points_local = n_points_right;
-    node_id = node_id_right;
-    build_tree();
-
-    node->left_id = node_id_left;
-    node->right_id = node_id_right;
-}
-
 /***********************************************************************************************************************************************/
 /***********************************************************************************************************************************************/
 /**** MPI Implementation. Used when the number of processes of the current team is more than one and points are distributed among processes ****/
+/**** Once a team has a single process it builds its subtree with the shared memory implementation in build_tree.c                        ****/
 /***********************************************************************************************************************************************/
 /***********************************************************************************************************************************************/
 
@@ -235,32 +108,23 @@ int mpi_split_communication_group() {
 /*
 Returns the point in the global point set that is furthest away from point p
 */
-void mpi_get_furthest_away_point(double *p, double *out) {
-    double local_max_distance = 0.0;
-    double *local_furthest_point = p;
-
+void mpi_get_furthest_away_point(coord_t *p, coord_t *out) {
     /*compute local furthest point from p*/
-    for(long i = 0; i < n_points_local; i++){
-        double curr_distance = distance(p, pts[i]);
-        if(curr_distance > local_max_distance){
-            local_max_distance = curr_distance;
-            local_furthest_point = pts[i];
-        }
-    }
+    coord_t *local_furthest_point = get_furthest_away_point(pts, n_points_local, p);
 
     /*get local furthest point from p of all processes*/
     MPI_Allgather(
                 local_furthest_point,             /* send local furthest point to all other processes */
                 n_dims,                           /* local furthest point has n_dims elements  */
-                MPI_DOUBLE,                       /* each element is of type double */
+                MPI_COORD,                        /* each element is a coordinate */
                 *furthest_away_point_buffer,      /* store each local furthest_away_point in the buffer */
                 n_dims,                           /* each local_furthest_point has n_dims elements  */
-                MPI_DOUBLE,                       /* each element is of type double */
+                MPI_COORD,                        /* each element is a coordinate */
                 communicator                      /* broadcast to all processes in the current team */
     );
 
     double global_max_distance = 0.0;
-    double *global_furthest_point = p;
+    coord_t *global_furthest_point = p;
 
     /*of those, compute the furthest away from p*/
     for(int i = 0; i < n_procs; i++) {
@@ -276,51 +140,59 @@ void mpi_get_furthest_away_point(double *p, double *out) {
 /*
 Returns the radius of the ball tree node defined by point center
 */
-double mpi_get_radius(double* center) {
+double mpi_get_radius(coord_t* center) {
     mpi_get_furthest_away_point(center, furthest_from_center);
     return sqrt(distance(furthest_from_center, center));
 }
 
 /*
-Returns the median projection of the dataset
-by sorting the projections based on their x coordinate
+Returns the median projection of the dataset.
+By default the middle projection parameters are found by distributed selection,
+compiling with -DPSRS_GET_CENTER sorts them with psrs instead.
+Places in split the upper middle parameter, the boundary between the left and right partitions
 */
-double* mpi_get_center(double *out) {
+coord_t* mpi_get_center(double *split, coord_t *out) {
+    double first_middle, second_middle;
+#ifdef PSRS_GET_CENTER
     if (n_points_global < n_procs * n_procs) {
-        mpi_naive_get_center(out);
+        mpi_naive_get_center(&first_middle, &second_middle);
     } else {
-        mpi_psrs_get_center(out);
+        mpi_psrs_get_center(&first_middle, &second_middle);
     }
+#else
+    mpi_select_get_center(&first_middle, &second_middle);
+#endif
+
+    if(n_points_global % 2) {
+        /* is odd */
+        projection_point(basub, a, second_middle, out);
+    }
+    else {
+        /* is even */
+        projection_point(basub, a, first_middle, median_left_point);
+        projection_point(basub, a, second_middle, median_right_point);
+        middle_point(median_left_point, median_right_point, out);
+    }
+    *split = second_middle;
     return out;
 }
 
 /*
-Copies into pts_aux first the points whose projection is left of center
-and then the points whose projection is right or equal to center
+Copies into pts_aux first the points whose projection parameter is smaller than split
+and then the points whose projection parameter is greater or equal to split
 sets n_points_left and n_points_right to the respective values
 */
-void mpi_fill_partitions(double* center, long *n_points_left, long *n_points_right) {
+void mpi_fill_partitions(double split, long *n_points_left, long *n_points_right) {
     long left_count = 0;
-    long right_count = 0;
 
-    /* left partition points */
     for(long i = 0; i < n_points_local; i++) {
-        if(ortho_array[i][0] < center[0]) {
-            copy_point(pts[i], pts_aux[left_count]);
-            left_count++;
-        }
+        left_count += ortho_array[i] < split;
     }
 
-    /* right partition points */
-    for(long i = 0; i < n_points_local; i++) {
-        if(ortho_array[i][0] >= center[0]) {
-            copy_point(pts[i], pts_aux[left_count + right_count]);
-            right_count++;
-        }
-    }
+    fill_partitions(pts, n_points_local, ortho_array, pts_aux, pts_aux + left_count, split, left_count);
 
     *n_points_left = left_count;
-    *n_points_right = right_count;
+    *n_points_right = n_points_local - left_count;
 }
 
 /*
@@ -377,7 +249,7 @@ void mpi_get_transfer_send_info(int *receive_counts, int *send_counts, int *send
 Transfers the left partition points to the respective team such that
 the points retain their original order and are evenly split among the new team
 */
-long mpi_async_transfer_left_partition(long n_points_local_left, long n_points_global_left, double** send_buf, double** recv_buf, MPI_Request *request) {
+long mpi_async_transfer_left_partition(long n_points_local_left, long n_points_global_left, coord_t** send_buf, coord_t** recv_buf, MPI_Request *request) {
     long processes_n_points_left[n_procs];
     int receive_counts[n_procs];
     int receive_displacement[n_procs];
@@ -404,11 +276,11 @@ long mpi_async_transfer_left_partition(long n_points_local_left, long n_points_g
                 *send_buf,              /* starting address of sent data */
                 send_counts,            /* number of elements to send to each process */
                 send_displacement,      /* buffer offset of data elements to send to each process */
-                MPI_DOUBLE,             /* send values of type double */
+                MPI_COORD,              /* send coordinate values */
                 *recv_buf,              /* starting address where received data is written */
                 receive_counts,         /* number of elements to receive from each process */
                 receive_displacement,   /* buffer offset of data elements received from each process */
-                MPI_DOUBLE,             /* receive values of type double */
+                MPI_COORD,              /* receive coordinate values */
                 communicator,           /* sending and receiving to all processes in the current team */
                 request
     );
@@ -420,7 +292,7 @@ long mpi_async_transfer_left_partition(long n_points_local_left, long n_points_g
 Transfers the right partition points to the respective team such that
 the points retain their original order and are evenly split among the new team
 */
-long mpi_async_transfer_right_partition(long n_points_local_right, long n_points_global_right, double** send_buf, double** recv_buf, MPI_Request *request) {
+long mpi_async_transfer_right_partition(long n_points_local_right, long n_points_global_right, coord_t** send_buf, coord_t** recv_buf, MPI_Request *request) {
     long processes_n_points_right[n_procs];
     int receive_counts[n_procs];
     int send_counts[n_procs];
@@ -448,11 +320,11 @@ long mpi_async_transfer_right_partition(long n_points_local_right, long n_points
                 *send_buf,              /* starting address of sent data */
                 send_counts,            /* number of elements to send to each process */
                 send_displacement,      /* buffer offset of data elements to send to each process */
-                MPI_DOUBLE,             /* send values of type double */
+                MPI_COORD,              /* send coordinate values */
                 *recv_buf,              /* starting address where received data is written */
                 receive_counts,         /* number of elements to receive from each process */
                 receive_displacement,   /* buffer offset of data elements received from each process */
-                MPI_DOUBLE,             /* receive values of type double */
+                MPI_COORD,              /* receive coordinate values */
                 communicator,           /* sending and receiving to all processes in the current team */
                 request
     );
@@ -460,10 +332,61 @@ long mpi_async_transfer_right_partition(long n_points_local_right, long n_points
     return size;
 }
 
+/*
+Gathers the points of the current team at its first process, which makes them a bucket leaf
+*/
+void mpi_build_bucket() {
+    mpi_get_processes_counts(n_points_local, processes_n_points);
+
+    int receive_counts[n_procs];
+    int receive_displacement[n_procs];
+    long n_points_team = 0;
+    for(int i = 0; i < n_procs; i++) {
+        receive_counts[i] = processes_n_points[i] * n_dims;
+        receive_displacement[i] = n_points_team * n_dims;
+        n_points_team += processes_n_points[i];
+    }
+
+    coord_t** team_pts = rank == 0 ? create_array_pts(n_dims, n_points_team) : NULL;
+    MPI_Gatherv(
+                *pts,                   /* starting address of sent data */
+                n_points_local * n_dims,/* number of coordinates sent */
+                MPI_COORD,              /* send coordinate values */
+                rank == 0 ? *team_pts : NULL, /* first process receives the points of the team in rank order */
+                receive_counts,         /* number of coordinates received from each process */
+                receive_displacement,   /* buffer offset of the coordinates received from each process */
+                MPI_COORD,              /* receive coordinate values */
+                0,                      /* gathered at the first process of the team */
+                communicator            /* current team */
+    );
+
+    if(rank == 0) {
+        make_bucket(team_pts, n_points_team, leaf_points + leaf_point_counter, node_id, node_counter);
+        leaf_point_counter += n_points_team;
+        node_counter++;
+        free(team_pts[0]);
+        free(team_pts);
+    }
+}
+
 void mpi_build_tree() {
 
     if (n_procs == 1) {
-        build_tree();
+        if(build_options.soa_layout) {
+            build_tree_from_soa(pts, ortho_array, ortho_array_srt, leaf_points + leaf_point_counter, n_points_local, node_id, node_counter);
+        }
+        else {
+            build_tree(pts, pts_aux, ortho_array, ortho_array_srt, leaf_points + leaf_point_counter, n_points_local, node_id, node_counter);
+        }
+        node_counter += count_tree_nodes(n_points_local);
+        if(build_options.leaf_size > 1) {
+            leaf_point_counter += n_points_local;
+        }
+        return;
+    }
+
+    if(n_points_global <= build_options.leaf_size && build_options.leaf_size > 1) {
+        mpi_build_bucket();
         return;
     }
 
@@ -484,13 +407,14 @@ void mpi_build_tree() {
     mpi_get_furthest_away_point(first_point, a);
     mpi_get_furthest_away_point(a, b);
 
-    calc_orthogonal_projections(a, b);
+    calc_orthogonal_projections(pts, n_points_local, a, b, basub, ortho_tmp, ortho_array);
 
-    double *center = mpi_get_center(node_centers[node_counter]);
+    double split;
+    coord_t *center = mpi_get_center(&split, node_centers[node_counter]);
     double radius = mpi_get_radius(center);
 
     long n_points_local_left, n_points_local_right;
-    mpi_fill_partitions(center, &n_points_local_left, &n_points_local_right);
+    mpi_fill_partitions(split, &n_points_local_left, &n_points_local_right);
 
     long n_points_global_left = LEFT_PARTITION_SIZE(n_points_global);
     long n_points_global_right = RIGHT_PARTITION_SIZE(n_points_global);
@@ -531,8 +455,106 @@ void mpi_build_tree() {
 }
 
 /*
-Print the local tree at each process.
-Each process waits for the processes with lower rank to finish before printing
+Writes the size bytes at buffer of every process one after the other in rank order, after the bytes written so far.
+With --output the processes write their bytes at once with collective MPI-IO writes, each at the offset given by the
+byte counts of the processes before it. Otherwise the first process prints its bytes and then those of every other
+process, received in rank order, to stdout
+*/
+void mpi_write_in_rank_order(char* buffer, long size) {
+    if (tree_file == MPI_FILE_NULL) {
+        if (rank) {
+            MPI_Send(&size, 1, MPI_LONG, 0, MPI_TAG_DUMP_TREE, communicator);
+            for (long sent = 0; sent < size; sent += OUTPUT_CHUNK) {
+                MPI_Send(buffer + sent, MIN(size - sent, OUTPUT_CHUNK), MPI_BYTE, 0, MPI_TAG_DUMP_TREE, communicator);
+            }
+            return;
+        }
+        fwrite(buffer, 1, size, stdout);
+        for (int process = 1; process < n_procs; process++) {
+            long process_size;
+            MPI_Recv(&process_size, 1, MPI_LONG, process, MPI_TAG_DUMP_TREE, communicator, MPI_STATUS_IGNORE);
+            char* chunk = (char*) malloc(MIN(process_size, OUTPUT_CHUNK) + 1);
+            for (long received = 0; received < process_size; received += OUTPUT_CHUNK) {
+                long chunk_size = MIN(process_size - received, OUTPUT_CHUNK);
+                MPI_Recv(chunk, chunk_size, MPI_BYTE, process, MPI_TAG_DUMP_TREE, communicator, MPI_STATUS_IGNORE);
+                fwrite(chunk, 1, chunk_size, stdout);
+            }
+            free(chunk);
+        }
+        fflush(stdout);
+        return;
+    }
+
+    long offset = 0;
+    long total_size;
+    long n_rounds = (size + OUTPUT_CHUNK - 1) / OUTPUT_CHUNK;
+    MPI_Exscan(&size, &offset, 1, MPI_LONG, MPI_SUM, communicator);
+    if (!rank) {
+        offset = 0;
+    }
+    MPI_Allreduce(&size, &total_size, 1, MPI_LONG, MPI_SUM, communicator);
+    MPI_Allreduce(MPI_IN_PLACE, &n_rounds, 1, MPI_LONG, MPI_MAX, communicator);
+
+    /* the writes are collective, so every process takes part in every round even once its bytes are written */
+    for (long round = 0; round < n_rounds; round++) {
+        long written = MIN(round * OUTPUT_CHUNK, size);
+        MPI_File_write_at_all(
+                tree_file,                          /* output file */
+                tree_file_offset + offset + written,/* after the bytes of the processes before this one */
+                buffer + written,                   /* next chunk of bytes of this process */
+                MIN(size - written, OUTPUT_CHUNK),  /* nothing once they are all written */
+                MPI_BYTE,
+                MPI_STATUS_IGNORE
+        );
+    }
+    tree_file_offset += total_size;
+}
+
+/*
+Writes what dump writes at each process, in rank order, the first process writing what prefix writes before it.
+Each process formats its part into memory, so the processes only wait on each other for the writes
+*/
+void mpi_dump_in_rank_order(void (*prefix)(FILE* out), void (*dump)(FILE* out)) {
+    char* buffer;
+    size_t size;
+    FILE* out = open_memstream(&buffer, &size);
+    if (out == NULL) {
+        fprintf(stderr, "Cannot allocate the output buffer, exiting.\n");
+        MPI_Abort(MPI_COMM_WORLD, 10);
+    }
+    if (!rank && prefix != NULL) {
+        prefix(out);
+    }
+    dump(out);
+    fclose(out);
+
+    mpi_write_in_rank_order(buffer, size);
+    free(buffer);
+}
+
+/*
+Writes the header line of a text tree file or the header of a binary tree file
+*/
+void dump_header(FILE* out) {
+    if (build_options.binary_format) {
+        dump_tree_binary_header(out, n_nodes);
+    }
+    else if (build_options.leaf_size > 1) {
+        fprintf(out, "%d %ld %ld\n", n_dims, n_nodes, n_leaf_points);
+    }
+    else {
+        fprintf(out, "%d %ld\n", n_dims, n_nodes);
+    }
+}
+
+void dump_points_padding(FILE* out) {
+    dump_tree_binary_points_padding(out, n_nodes);
+}
+
+/*
+Writes the local tree of every process, in rank order, to the --output file or to stdout.
+Binary tree files hold all the node records before all the centers and all the centers before the points of the leaves,
+so they are written in as many rounds
 */
 void mpi_dump_tree(double exec_time) {
     /* restore world communicator and original ranking to print the tree in order */
@@ -542,38 +564,40 @@ void mpi_dump_tree(double exec_time) {
 
     if (!rank) {
         fprintf(stderr, "%.1lf\n", exec_time);
-        printf("%d %ld\n", n_dims, n_nodes);
     }
 
-    char dump_tree_token;
+    /* bucket leaves refer to their points by their index in the whole tree */
+    MPI_Exscan(&leaf_point_counter, &leaf_points_offset, 1, MPI_LONG, MPI_SUM, communicator);
+    MPI_Allreduce(&leaf_point_counter, &n_leaf_points, 1, MPI_LONG, MPI_SUM, communicator);
+    if (!rank) {
+        leaf_points_offset = 0;
+    }
 
-    /*wait for the previous process to print its tree*/
-    if (rank) {
-        MPI_Recv(
-                &dump_tree_token,   /* address where the token is received */
-                1,                  /* token is one element */
-                MPI_CHAR,           /* of type char */
-                rank - 1,           /* from the process with current rank - 1 */
-                MPI_TAG_DUMP_TREE,  /* unique tag identifying what i am receiving */
-                communicator,       /* global communicator */
-                MPI_STATUS_IGNORE   /* don't care about the return status */
-        );
+    tree_file = MPI_FILE_NULL;
+    tree_file_offset = 0;
+    if (build_options.output_path != NULL) {
+        if (MPI_File_open(communicator, build_options.output_path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &tree_file) != MPI_SUCCESS) {
+            if (!rank) {
+                fprintf(stderr, "Cannot create output file '%s'.\n", build_options.output_path);
+            }
+            MPI_Abort(MPI_COMM_WORLD, 5);
+        }
+        MPI_File_set_size(tree_file, 0);
     }
-    sleep(1); //give time for the previous process to flush his stdout
 
-    dump_tree();
-    fflush(stdout);
+    if (build_options.binary_format) {
+        mpi_dump_in_rank_order(dump_header, dump_tree_binary_nodes);
+        mpi_dump_in_rank_order(NULL, dump_tree_binary_centers);
+        if (build_options.leaf_size > 1) {
+            mpi_dump_in_rank_order(dump_points_padding, dump_tree_binary_points);
+        }
+    }
+    else {
+        mpi_dump_in_rank_order(dump_header, dump_tree);
+    }
 
-    /*tell the next process to print its tree*/
-    if (rank != (n_procs - 1)) {
-        MPI_Send(
-                &dump_tree_token,   /* address of the sent token */
-                1,                  /* token is one element */
-                MPI_CHAR,           /* of type char */
-                rank + 1,           /* sent to the process with current rank + 1 */
-                MPI_TAG_DUMP_TREE,  /* unique tag identifying what i am sending */
-                communicator        /* global communicator */
-        );
+    if (tree_file != MPI_FILE_NULL) {
+        MPI_File_close(&tree_file);
     }
 }
 
@@ -584,23 +608,27 @@ void alloc_memory() {
     long node_buffer_size = max_split_depth + (2 * point_buffer_size) - 1;
 
     n_points_local = BLOCK_SIZE(rank, n_procs, n_points_global);
-    n_nodes = (n_points_global * 2) - 1;
+    n_nodes = count_tree_nodes(n_points_global);
 
     pts_aux = create_array_pts(n_dims, point_buffer_size);
-    ortho_array = create_array_pts(n_dims, point_buffer_size);
-    ortho_array_srt = (double**) malloc(sizeof(double*) * point_buffer_size);
+    ortho_array = (double*) malloc(sizeof(double) * point_buffer_size);
+    ortho_array_srt = (double*) malloc(sizeof(double) * point_buffer_size);
 
     node_list = (node_ptr) malloc(sizeof(node_t) * node_buffer_size);
     node_centers = create_array_pts(n_dims, node_buffer_size);
+    if (build_options.leaf_size > 1) {
+        /* a process ends with either its local subtree or a single bucket of its team */
+        leaf_points = create_array_pts(n_dims, MAX(point_buffer_size, MIN(build_options.leaf_size, n_points_global)));
+    }
 
-    basub = (double*) malloc(sizeof(double) * n_dims);
-    ortho_tmp = (double*) malloc(sizeof(double) * n_dims);
-    first_point = (double*) malloc(sizeof(double) * n_dims);
-    a = (double*) malloc(sizeof(double) * n_dims);
-    b = (double*) malloc(sizeof(double) * n_dims);
-    furthest_from_center = (double*) malloc(sizeof(double) * n_dims);
-    median_left_point = (double*) malloc(sizeof(double) * n_dims);
-    median_right_point = (double*) malloc(sizeof(double) * n_dims);
+    basub = (coord_t*) malloc(sizeof(coord_t) * n_dims);
+    ortho_tmp = (coord_t*) malloc(sizeof(coord_t) * n_dims);
+    first_point = (coord_t*) malloc(sizeof(coord_t) * n_dims);
+    a = (coord_t*) malloc(sizeof(coord_t) * n_dims);
+    b = (coord_t*) malloc(sizeof(coord_t) * n_dims);
+    furthest_from_center = (coord_t*) malloc(sizeof(coord_t) * n_dims);
+    median_left_point = (coord_t*) malloc(sizeof(coord_t) * n_dims);
+    median_right_point = (coord_t*) malloc(sizeof(coord_t) * n_dims);
 
     processes_n_points = (long*) malloc(sizeof(long) * n_procs);
     furthest_away_point_buffer = create_array_pts(n_dims, n_procs);
@@ -613,13 +641,38 @@ int main(int argc, char** argv) {
     double exec_time;
     exec_time = -omp_get_wtime();
 
-    MPI_Init (&argc, &argv);
+    /* only the master thread of each process makes mpi calls, the other threads run the local scans and subtrees */
+    int thread_level;
+    MPI_Init_thread (&argc, &argv, MPI_THREAD_FUNNELED, &thread_level);
     MPI_Comm_rank (MPI_COMM_WORLD, &rank);
     MPI_Comm_size (MPI_COMM_WORLD, &n_procs);
 
-    pts = get_points(argc, argv, &n_dims, &n_points_global);
+    if (thread_level < MPI_THREAD_FUNNELED) {
+        if (!rank) {
+            fprintf(stderr, "MPI does not support threads, running with a single thread per process.\n");
+        }
+        omp_set_num_threads(1);
+    }
+
+    parse_build_options(&argc, argv);
+    if (build_options.memory_budget > 0) {
+        if (!rank) {
+            fprintf(stderr, "--memory-budget is only supported by ballAlg, ballAlg-mpi spreads the points over the memory of its processes.\n");
+        }
+        MPI_Finalize();
+        exit(5);
+    }
+    if (build_options.input_path != NULL) {
+        pts = load_points(argc, argv, build_options.input_path, &n_dims, &n_points_global);
+    }
+    else {
+        pts = get_points(argc, argv, &n_dims, &n_points_global);
+    }
+    init_point_kernels(n_dims);
     alloc_memory();
 
+    #pragma omp parallel
+    #pragma omp master
     mpi_build_tree();
 
     MPI_Barrier(MPI_COMM_WORLD);
@@ -1,178 +1,1844 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <omp.h>
+#include "coords.h"
+#include "point_kernels.h"
+#include "tree_format.h"
+#include "points_format.h"
 
-typedef struct _node {
-    double radius;
+#define QUERY_BLOCK 16384  // most queries read and answered at a time in batch mode
+#define QUERY_BLOCK_ANSWERS (1L << 20)  // neighbors of the queries of a block at most, fewer queries per block with large k
+#define QUERY_CHUNK 16     // queries a thread takes at a time, small since the cost of a query varies a lot
+#define PARSE_CHUNKS_PER_THREAD 4  // pieces of a text tree file per thread, so threads parsing longer lines do not hold the rest up
+#define MAX_EXACT_POW10 22         // largest power of 10 exactly representable as a double
+#define MAX_NUMBER_LENGTH 64       // longest number handed to strtod by scan_double
+#define SERVER_MAX_CLIENTS 64      // connections the query server serves at once
+#define SERVER_READ_SIZE 65536     // bytes the query server reads from a client at a time
+#define SERVER_MAX_LINE (1L << 20) // longest request line of the query server, longer ones are answered with an error
+#define LATENCY_WINDOW 65536       // latest requests whose latencies make up the percentiles of the query server
+#define HUGE_PAGE_SIZE (1L << 21)  // alignment of the laid out nodes, so they can be backed by transparent huge pages
+#define LEAF_BLOCK 256             // points of a leaf whose distances are computed at a time
+
+typedef struct _node {  // same layout as the records of binary tree files, which are used in place
     long id;
-    long L;
-    long R;
+    long L;         // id of the left child in the file, whose index in tree resolve_children puts in children,
+                    // minus the number of points of the leaves of bucket trees
+    long R;         // id of the right child in the file, whose index in tree resolve_children puts in children,
+                    // the index in tree_points of the first point of the leaves of bucket trees
+    double radius;
 } node_t;
 
-typedef struct _hash {
-    long id;
-    long index;
-    struct _hash *next;
-} hash_t;
+_Static_assert(sizeof(node_t) == sizeof(struct tree_file_node), "node_t must match the binary node records");
+
+typedef struct _packed_node {  // node of the tree the queries search, with its center in the same cache lines
+    long L;             // index of the left child in nodes, minus the number of points of leaves
+    long R;             // index of the right child in nodes, index in points of the first point of leaves
+    double radius;
+    coord_t center[];   // n_dims coordinates
+} packed_node_t;
+
+typedef struct _search {  // state of one nearest neighbor search, one per thread
+    coord_t *point;
+    double minSqDist;   // squared distance of the closest point found so far
+    double minDist;     // its distance, kept to bound the children without a square root per child
+    long currBest;
+    long *excluded;     // points skipped by the search, for the k nearest neighbors by passes
+    long n_excluded;
+    long visits;        // nodes visited, for the statistics of batch mode
+} search_t;
+
+typedef struct _neighbor {
+    double dist;
+    long idx;
+} neighbor_t;
+
+typedef struct _knn_search {  // state of one k nearest neighbors search, one per thread
+    coord_t *point;
+    neighbor_t *heap;   // max-heap by squared distance of the k closest points found so far
+    long size;
+    long k;
+    double kth_dist;    // distance of the top of the heap once it holds k points, HUGE_VAL before
+    long visits;        // nodes visited, for the statistics of batch mode
+} knn_search_t;
+
+typedef struct _range_search {  // state of one range search, one per thread
+    coord_t *point;
+    double radius;
+    void (*emit)(struct _range_search *search, long idx);  // called for each point in range, in tree order
+    long *found;        // points in range collected by emit_collect
+    long n_found;
+    long capacity;
+    long visits;        // nodes visited, for the statistics of batch mode
+} range_search_t;
+
+typedef struct _client {  // a connection of the query server, or stdin and stdout
+    int fd;             // requests are read from fd
+    int out_fd;         // and their replies written to out_fd
+    FILE *out;          // memory stream of the replies of the batch being answered, NULL between batches
+    char *reply;        // its buffer
+    size_t reply_size;
+    char *output;       // replies not written yet, the requests of the client are not read until they are
+    long output_size;
+    long output_sent;   // bytes of output already written
+    char *buffer;       // bytes read that do not make up a whole request line yet
+    long size;
+    long capacity;
+    int closed;         // end of file read, closed once its requests are answered
+    int discarding;     // dropping the rest of a line longer than SERVER_MAX_LINE, up to its newline
+} client_t;
+
+enum request_kind { REQUEST_QUERY, REQUEST_STATS, REQUEST_ERROR, REQUEST_BAD_K, REQUEST_NO_MEMORY, REQUEST_TOO_LONG };
+
+typedef struct _request {  // a request line of the query server
+    client_t *client;
+    enum request_kind kind;
+    long k;             // neighbors asked for, 0 for the nearest one
+    long first_answer;  // position of its neighbors in the answers of the batch
+    long n_neighbors;
+    double received;    // time its line was read
+} request_t;
+
+typedef struct _server {
+    int listen_fd;      // socket accepting connections, -1 when serving stdin
+    client_t clients[SERVER_MAX_CLIENTS];
+    int n_clients;
+    request_t *requests;    // requests of the batch, QUERY_BLOCK at most
+    coord_t *queries;       // their points
+    long n_requests;
+    neighbor_t *answers;    // their neighbors
+    long answers_capacity;
+    double *latencies;  // ring of the latencies of the latest LATENCY_WINDOW requests, in seconds
+    long n_answered;
+} server_t;
+
+typedef struct _point_list {  // points of the leaves parsed by one thread from a text tree file
+    coord_t *coords;
+    long n_points;
+    long capacity;
+} point_list_t;
+
+typedef struct _query_options {
+    long k;             // number of neighbors of -k, 0 for the single nearest neighbor output
+    int knn_by_passes;  // --knn-by-passes: find the k nearest neighbors with k nearest neighbor searches
+    double radius;      // radius of -r range queries, negative for nearest neighbor queries
+} query_options_t;
 
 int n_dims;
 long n_nodes;
-double *point;
 
-node_t *tree;
-double **center;
-hash_t **hash;
+node_t *tree;       // nodes as loaded from the tree file, replaced by nodes once the tree is laid out
+coord_t *centers;   // the center of node i is at centers + i * n_dims
+void *mapped_file;  // binary tree file tree and centers are in, NULL for text tree files
+size_t mapped_size;
+
+#define CENTER(I) (centers + (I) * n_dims)
+
+long *children;     // indices in tree of the left and right children of each inner node, so the records are only read
+
+#define LEFT_CHILD(I) (children[2 * (I)])
+#define RIGHT_CHILD(I) (children[2 * (I) + 1])
 
-long currBest;
-double minDist = 1000000.0;
+coord_t *tree_points;   // points of the leaves of bucket trees as loaded, NULL for trees with a leaf per point
+long n_tree_points;
 
+char *nodes;        // the nodes searched, in van Emde Boas order, node_size bytes each
+long node_size;
 
-void allocate_hash()
+#define NODE(I) ((packed_node_t *) (nodes + (I) * node_size))
+
+coord_t *points;    // the points of the leaves in the order of the leaves in nodes, the center of leaves of a single point
+long n_points;
+
+#define POINT(I) (points + (I) * n_dims)
+
+long root;          // index of the root node in tree, then in nodes
+
+query_options_t query_options = {
+    .k = 0,
+    .knn_by_passes = 0,
+    .radius = -1.0
+};
+
+void allocate_tree()
 {
-    hash = (hash_t **) calloc(n_nodes, sizeof(hash_t *));
-    if(hash == NULL){
-        printf("Error allocating hash, exiting.\n");
-        exit(20);
+    tree = (node_t *) malloc(n_nodes * sizeof(node_t));
+    centers = (coord_t *) malloc(n_nodes * n_dims * sizeof(coord_t));
+    if((centers == NULL) || (tree == NULL)){
+        printf("Error allocating tree, exiting.\n");
+        exit(10);
     }
 }
 
-void hash_insert(long tree_id, long array_idx)
+/*
+Checks the sizes of the tree file header. A bucket tree may be a single leaf
+*/
+void check_tree_size(int buckets)
 {
-    hash_t *new;
-    long i;
+    if(n_dims < 2){
+        printf("Illegal number of dimensions (%d), must be above 1.\n", n_dims);
+        exit(3);
+    }
+    if(n_nodes < (buckets ? 1 : 2)){
+        printf("Illegal number of nodes (%ld), must be above %d.\n", n_nodes, buckets ? 0 : 1);
+        exit(2);
+    }
+}
 
-    i = tree_id % n_nodes;
+/*
+Returns the first character from p on that is not a blank, or end
+*/
+const char *skip_blanks(const char *p, const char *end)
+{
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
 
-    new = (hash_t *) malloc(sizeof(hash_t));
-    new->id = tree_id;
-    new->index = array_idx;
-    new->next = hash[i];
-    hash[i] = new;
+/*
+Reads the integer at *p, skipping the blanks before it, into value and advances *p past it.
+Returns 1, or 0 if there is no integer at *p
+*/
+int scan_long(const char **p, const char *end, long *value)
+{
+    const char *c = skip_blanks(*p, end);
+    const char *digits;
+    long v = 0;
+    int negative = 0;
+
+    if(c < end && (*c == '-' || *c == '+'))
+        negative = *c++ == '-';
+    for(digits = c; c < end && *c >= '0' && *c <= '9'; c++)
+        v = v > (LONG_MAX - (*c - '0')) / 10 ? LONG_MAX : v * 10 + (*c - '0');  // saturates instead of overflowing
+    if(c == digits)
+        return 0;
+    *value = negative ? -v : v;
+    *p = c;
+    return 1;
 }
 
-long hash_get_index(long id)
+/*
+Reads the number at *p, skipping the blanks before it, into value and advances *p past it.
+Returns 1, or 0 if there is no number at *p.
+Decimals with at most 19 digits, whose digits and power of 10 are exact in a double, are converted with a single
+correctly rounded division, which gives the same double as strtod. Anything else (exponents, long mantissas,
+inf or nan) is handed to strtod. The tree files are written in the C locale, which ballQuery never changes
+*/
+int scan_double(const char **p, const char *end, double *value)
 {
+    static const double pow10[MAX_EXACT_POW10 + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    char number[MAX_NUMBER_LENGTH + 1];
+    const char *start = skip_blanks(*p, end);
+    const char *c = start;
+    unsigned long mantissa = 0;
+    int n_digits = 0;
+    int n_decimals = 0;
+    int negative = 0;
+    char *number_end;
+    long length;
+
+    if(c < end && (*c == '-' || *c == '+'))
+        negative = *c++ == '-';
+    for(; c < end && *c >= '0' && *c <= '9'; c++, n_digits++)
+        mantissa = mantissa * 10 + (*c - '0');
+    if(c < end && *c == '.')
+        for(c++; c < end && *c >= '0' && *c <= '9'; c++, n_digits++, n_decimals++)
+            mantissa = mantissa * 10 + (*c - '0');
+
+    if(n_digits > 0 && n_digits <= 19 && mantissa <= (1UL << 53) && n_decimals <= MAX_EXACT_POW10 &&
+       (c == end || *c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')){
+        *value = (double) mantissa / pow10[n_decimals];
+        if(negative)
+            *value = -*value;
+        *p = c;
+        return 1;
+    }
+
+    // slow path: the file is not null terminated, so copy the number out for strtod
+    for(c = start; c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n'; c++)
+        ;
+    length = c - start;
+    if(length == 0 || length > MAX_NUMBER_LENGTH)
+        return 0;
+    memcpy(number, start, length);
+    number[length] = '\0';
+    *value = strtod(number, &number_end);
+    if(number_end != number + length)
+        return 0;
+    *p = c;
+    return 1;
+}
+
+/*
+Returns the start of the line after the one at p, or end
+*/
+const char *next_line(const char *p, const char *end)
+{
+    p = memchr(p, '\n', end - p);
+    return p == NULL ? end : p + 1;
+}
+
+/*
+Parses the node lines from line to end into tree and centers, starting with node i.
+In bucket trees the points of the leaves go to leaf_points, growing it as needed, and the R of each leaf is set to
+the index of its first point there. Lines past the n_nodes nodes are ignored
+*/
+void parse_tree_lines(const char *line, const char *end, long i, point_list_t *leaf_points)
+{
+    const char *p;
+    double value;
+    node_t *node;
+
+    for(; line < end && i < n_nodes; line = next_line(p, end), i++){
+        node = &(tree[i]);
+        p = line;
+        if(!scan_long(&p, end, &(node->id)) || !scan_long(&p, end, &(node->L)) ||
+           !scan_long(&p, end, &(node->R)) || !scan_double(&p, end, &(node->radius))){
+            printf("Malformed node %ld in the tree file.\n", i);
+            exit(2);
+        }
+        for(int d = 0; d < n_dims; d++){
+            if(!scan_double(&p, end, &value)){
+                printf("Node %ld has %d coordinates in the tree file, expected %d.\n", i, d, n_dims);
+                exit(2);
+            }
+            CENTER(i)[d] = value;
+        }
+        if(tree_points == NULL || node->L >= 0)
+            continue;
+
+        if(leaf_points->n_points - node->L > leaf_points->capacity){
+            leaf_points->capacity = 2 * (leaf_points->n_points - node->L);
+            leaf_points->coords = (coord_t *) realloc(leaf_points->coords, leaf_points->capacity * n_dims * sizeof(coord_t));
+            if(leaf_points->coords == NULL){
+                printf("Error allocating tree, exiting.\n");
+                exit(10);
+            }
+        }
+        node->R = leaf_points->n_points;
+        for(long c = 0; c < -node->L * n_dims; c++){
+            if(!scan_double(&p, end, &value)){
+                printf("Leaf %ld has %ld point coordinates in the tree file, expected %ld.\n", i, c, -node->L * n_dims);
+                exit(2);
+            }
+            leaf_points->coords[leaf_points->n_points * n_dims + c] = value;
+        }
+        leaf_points->n_points -= node->L;
+    }
+}
+
+/*
+Reads a text tree file: a line with n_dims and n_nodes (and the number of points of bucket trees) and then one line
+per node, the leaves of bucket trees listing their points after their center.
+The file is mapped into memory and split at line boundaries into pieces for the OpenMP threads. A first pass
+counts the lines of every piece, which gives the index of the first node of each one, then the threads parse
+their pieces straight into tree and centers. The points of the leaves of each piece are then moved to tree_points
+*/
+void load_text_tree(char *path)
+{
+    struct stat file_stat;
+    const char *file, *nodes, *end;
+    long n_chunks = omp_get_max_threads() * PARSE_CHUNKS_PER_THREAD;
+    const char *chunk_start[n_chunks + 1];
+    long first_node[n_chunks + 1];
+    long first_point[n_chunks + 1];
+    point_list_t chunk_points[n_chunks];
+    long header_dims;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &file_stat) < 0 || file_stat.st_size == 0){
+        printf("Cannot read tree file '%s'.\n", path);
+        exit(2);
+    }
+    file = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(file == MAP_FAILED){
+        printf("Cannot map tree file '%s'.\n", path);
+        exit(2);
+    }
+    end = file + file_stat.st_size;
+
+    nodes = file;
+    if(!scan_long(&nodes, end, &header_dims) || !scan_long(&nodes, end, &n_nodes)){
+        printf("Malformed tree file header.\n");
+        exit(2);
+    }
+    n_dims = header_dims;
+    if(!scan_long(&nodes, end, &n_tree_points))
+        n_tree_points = 0;
+    check_tree_size(n_tree_points > 0);
+    nodes = next_line(nodes, end);
+
+    allocate_tree();
+    if(n_tree_points > 0){
+        tree_points = (coord_t *) malloc(n_tree_points * n_dims * sizeof(coord_t));
+        if(tree_points == NULL){
+            printf("Error allocating tree, exiting.\n");
+            exit(10);
+        }
+    }
+
+    // split the node lines into pieces of about the same size, each starting at a line
+    for(long c = 0; c <= n_chunks; c++){
+        chunk_start[c] = nodes + (end - nodes) * c / n_chunks;
+        if(c > 0 && c < n_chunks && chunk_start[c] > nodes && chunk_start[c][-1] != '\n')
+            chunk_start[c] = next_line(chunk_start[c], end);
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(long c = 0; c < n_chunks; c++){
+        long n_lines = 0;
+        for(const char *line = chunk_start[c]; line < chunk_start[c + 1]; line = next_line(line, chunk_start[c + 1]))
+            n_lines++;
+        first_node[c + 1] = n_lines;
+    }
+    first_node[0] = 0;
+    for(long c = 0; c < n_chunks; c++)
+        first_node[c + 1] += first_node[c];
+    if(first_node[n_chunks] < n_nodes){
+        printf("Tree file has %ld nodes, expected %ld.\n", first_node[n_chunks], n_nodes);
+        exit(2);
+    }
+
+    memset(chunk_points, 0, sizeof(chunk_points));
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(long c = 0; c < n_chunks; c++)
+        parse_tree_lines(chunk_start[c], chunk_start[c + 1], first_node[c], &chunk_points[c]);
+    munmap((void *) file, file_stat.st_size);
+
+    if(tree_points == NULL)
+        return;
+    first_point[0] = 0;
+    for(long c = 0; c < n_chunks; c++)
+        first_point[c + 1] = first_point[c] + chunk_points[c].n_points;
+    if(first_point[n_chunks] != n_tree_points){
+        printf("Tree file has %ld leaf points, expected %ld.\n", first_point[n_chunks], n_tree_points);
+        exit(2);
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(long c = 0; c < n_chunks; c++){
+        memcpy(tree_points + first_point[c] * n_dims, chunk_points[c].coords, chunk_points[c].n_points * n_dims * sizeof(coord_t));
+        for(long i = first_node[c]; i < first_node[c + 1] && i < n_nodes; i++)
+            if(tree[i].L < 0)
+                tree[i].R += first_point[c];
+        free(chunk_points[c].coords);
+    }
+}
+
+/*
+Maps a binary tree file (see tree_format.h) into memory, using its node records, centers and leaf points in place.
+The mapping is only read, so its pages are those of the page cache, but loading still goes through every node:
+resolve_children indexes them and relayout_tree copies them into the searched layout, in time linear in the tree
+*/
+void map_binary_tree(char *path)
+{
+    struct tree_file_header *header;
+    struct stat file_stat;
+    char *file;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &file_stat) < 0 || file_stat.st_size < (off_t) sizeof(struct tree_file_header)){
+        printf("Cannot read binary tree file '%s'.\n", path);
+        exit(5);
+    }
+    file = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(file == MAP_FAILED){
+        printf("Cannot map binary tree file '%s'.\n", path);
+        exit(5);
+    }
+
+    header = (struct tree_file_header *) file;
+    if(header->version != TREE_FILE_VERSION && header->version != TREE_FILE_BUCKETS_VERSION){
+        printf("Unsupported binary tree file version %d, expected %d or %d.\n", header->version, TREE_FILE_VERSION,
+               TREE_FILE_BUCKETS_VERSION);
+        exit(5);
+    }
+    if(header->coord_size != sizeof(coord_t)){
+        printf("Binary tree file has %d byte coordinates, this ballQuery was built for %d byte coordinates.\n",
+               header->coord_size, (int) sizeof(coord_t));
+        exit(5);
+    }
+    n_dims = header->n_dims;
+    n_nodes = header->n_nodes;
+    check_tree_size(header->version == TREE_FILE_BUCKETS_VERSION);
+    if(file_stat.st_size < TREE_FILE_CENTERS_OFFSET(n_nodes) + n_nodes * n_dims * (int64_t) sizeof(coord_t)){
+        printf("Binary tree file '%s' is truncated.\n", path);
+        exit(5);
+    }
+
+    tree = (node_t *) (file + TREE_FILE_NODES_OFFSET);
+    centers = (coord_t *) (file + TREE_FILE_CENTERS_OFFSET(n_nodes));
+    if(header->version == TREE_FILE_BUCKETS_VERSION){
+        // the leaves are checked against the number of points when the tree is laid out
+        tree_points = (coord_t *) (file + TREE_FILE_POINTS_OFFSET(n_nodes, n_dims, sizeof(coord_t)));
+        n_tree_points = (file_stat.st_size - TREE_FILE_POINTS_OFFSET(n_nodes, n_dims, sizeof(coord_t))) / (n_dims * (long) sizeof(coord_t));
+        if(n_tree_points < 1){
+            printf("Binary tree file '%s' is truncated.\n", path);
+            exit(5);
+        }
+    }
+    mapped_file = file;
+    mapped_size = file_stat.st_size;
+}
+
+/*
+Returns the index in tree of the node with id, given the index of every id in index_of_id
+*/
+long get_index(long *index_of_id, long max_id, long id)
+{
+    if(id < 0 || id > max_id || index_of_id[id] < 0){
+        printf("Id %ld not found?!\n", id);
+        exit(30);
+    }
+    return index_of_id[id];
+}
+
+/*
+Puts in children the indices in tree of the children with ids L and R of every inner node and finds the root,
+so the layout follows children directly without writing to the records. The builders give heap ids (children 2i+1 and 2i+2) to balanced trees,
+so the ids stay below 2 * (n_nodes + 1) and a dense array maps them to indices
+*/
+void resolve_children()
+{
+    long *index_of_id;
+    long max_id = 0;
     long i;
-    hash_t *h;
 
-    i = id % n_nodes;
+    for(i = 0; i < n_nodes; i++)
+        max_id = tree[i].id > max_id ? tree[i].id : max_id;
 
-    for(h = hash[i]; h != NULL && h->id != id; h = h->next);
+    index_of_id = (long *) malloc((max_id + 1) * sizeof(long));
+    children = (long *) malloc(2 * n_nodes * sizeof(long));
+    if(index_of_id == NULL || children == NULL){
+        printf("Error allocating node index, exiting.\n");
+        exit(20);
+    }
+    for(i = 0; i <= max_id; i++)
+        index_of_id[i] = -1;
+    for(i = 0; i < n_nodes; i++){
+        if(tree[i].id < 0){
+            printf("Illegal node id (%ld).\n", tree[i].id);
+            exit(30);
+        }
+        index_of_id[tree[i].id] = i;
+    }
 
-    if(h == NULL){
-	printf("Id %d not found?!\n", id);
-	exit(30);
+    root = get_index(index_of_id, max_id, 0);
+    for(i = 0; i < n_nodes; i++){
+        if(tree[i].L < 0)   // leaves have no children
+            continue;
+        LEFT_CHILD(i) = get_index(index_of_id, max_id, tree[i].L);
+        RIGHT_CHILD(i) = get_index(index_of_id, max_id, tree[i].R);
     }
+    free(index_of_id);
+}
+
+/*
+Loads the tree in the file at path, detecting whether it is a binary or a text tree file
+*/
+void load_tree(char *path)
+{
+    char magic[TREE_FILE_MAGIC_SIZE];
+    FILE *fp;
 
-    return h->index;
+    fp = fopen(path, "r");
+    if(fp == NULL){
+        printf("Cannot open input file '%s'.\n", path);
+        exit(2);
+    }
+
+    if(fread(magic, 1, TREE_FILE_MAGIC_SIZE, fp) == TREE_FILE_MAGIC_SIZE && !memcmp(magic, TREE_FILE_MAGIC, TREE_FILE_MAGIC_SIZE)){
+        fclose(fp);
+        map_binary_tree(path);
+        return;
+    }
+    fclose(fp);
+    load_text_tree(path);
 }
-    
-void allocate_tree()
+
+/*
+Returns the number of levels of the subtree at idx of tree
+*/
+int subtree_height(long idx)
 {
-    double *_p_center;
+    int left, right;
 
-    tree = (node_t *) malloc(n_nodes * sizeof(node_t));
-    _p_center = (double *) malloc(n_nodes * n_dims * sizeof(double));
-    center = (double **) malloc(n_nodes * sizeof(double *));
-    if((_p_center == NULL) || (center == NULL) || (tree == NULL)){
+    if(tree[idx].L < 0)
+        return 1;
+    left = subtree_height(LEFT_CHILD(idx));
+    right = subtree_height(RIGHT_CHILD(idx));
+    return 1 + (left > right ? left : right);
+}
+
+void veb_order(long idx, int height, long *new_index, long *n_placed);
+
+/*
+Places the subtrees of height levels rooted depth levels below idx, from left to right
+*/
+void veb_order_bottoms(long idx, int depth, int height, long *new_index, long *n_placed)
+{
+    if(depth == 0){
+        veb_order(idx, height, new_index, n_placed);
+        return;
+    }
+    if(tree[idx].L < 0)     // a leaf above the bottom subtrees, placed with the top one
+        return;
+    veb_order_bottoms(LEFT_CHILD(idx), depth - 1, height, new_index, n_placed);
+    veb_order_bottoms(RIGHT_CHILD(idx), depth - 1, height, new_index, n_placed);
+}
+
+/*
+Gives the nodes of the first height levels of the subtree at idx their positions in van Emde Boas order,
+from n_placed on: the top half of the levels first and then each subtree below them, every part laid out
+the same way. Whatever the cache line and page sizes, searches then go through few of them per level
+*/
+void veb_order(long idx, int height, long *new_index, long *n_placed)
+{
+    int top = height / 2;
+
+    if(height == 1 || tree[idx].L < 0){
+        new_index[idx] = (*n_placed)++;
+        return;
+    }
+    veb_order(idx, top, new_index, n_placed);
+    veb_order_bottoms(idx, top, height - top, new_index, n_placed);
+}
+
+/*
+Returns the number of points of leaf i of tree, checking they are in tree_points
+*/
+long count_leaf_points(long i)
+{
+    if(tree_points == NULL)
+        return 1;
+    if(tree[i].L >= 0 || tree[i].R < 0 || tree[i].R - tree[i].L > n_tree_points){
+        printf("Leaf %ld has points %ld to %ld, the tree has %ld.\n", tree[i].id, tree[i].R, tree[i].R - tree[i].L - 1, n_tree_points);
+        exit(30);
+    }
+    return -tree[i].L;
+}
+
+/*
+Copies the loaded tree into nodes in van Emde Boas order, each node packed with its children, radius and center,
+and releases the loaded tree. Nodes not reachable from the root are dropped.
+The searches then read one record per node instead of a node record and a center far apart, and the nodes a
+search goes through are close together whatever order the builder wrote them in (ballAlg-mpi interleaves ranks).
+The points of the leaves are copied to points in the order of their leaves, the center of a leaf of a tree with
+a leaf per point being its point
+*/
+void relayout_tree()
+{
+    long *new_index;
+    long *old_index;
+    long n_placed = 0;
+    long nodes_size;
+    packed_node_t *node;
+
+    new_index = (long *) malloc(n_nodes * sizeof(long));
+    old_index = (long *) malloc(n_nodes * sizeof(long));
+    node_size = (sizeof(packed_node_t) + n_dims * sizeof(coord_t) + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+    nodes_size = (n_nodes * node_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    nodes = (char *) aligned_alloc(HUGE_PAGE_SIZE, nodes_size);
+    if(new_index == NULL || old_index == NULL || nodes == NULL){
         printf("Error allocating tree, exiting.\n");
         exit(10);
     }
+#ifdef MADV_HUGEPAGE
+    madvise(nodes, nodes_size, MADV_HUGEPAGE);  // fewer TLB misses on deep trees, only a hint
+#endif
     for(long i = 0; i < n_nodes; i++)
-        center[i] = &(_p_center[i * n_dims]);
+        new_index[i] = -1;
+    veb_order(root, subtree_height(root), new_index, &n_placed);
+
+    n_points = 0;
+    for(long i = 0; i < n_nodes; i++){
+        if(new_index[i] < 0)
+            continue;
+        old_index[new_index[i]] = i;
+        if(tree[i].L < 0)
+            n_points += count_leaf_points(i);
+    }
+    points = (coord_t *) malloc(n_points * n_dims * sizeof(coord_t));
+    if(points == NULL){
+        printf("Error allocating tree, exiting.\n");
+        exit(10);
+    }
+
+    n_points = 0;
+    for(long j = 0; j < n_placed; j++){
+        long i = old_index[j];
+        node = NODE(j);
+        node->radius = tree[i].radius;
+        memcpy(node->center, CENTER(i), n_dims * sizeof(coord_t));
+        if(tree[i].L >= 0){
+            node->L = new_index[LEFT_CHILD(i)];
+            node->R = new_index[RIGHT_CHILD(i)];
+            continue;
+        }
+        node->L = -count_leaf_points(i);
+        node->R = n_points;
+        memcpy(POINT(n_points), tree_points == NULL ? CENTER(i) : tree_points + tree[i].R * n_dims,
+               -node->L * n_dims * sizeof(coord_t));
+        n_points -= node->L;
+    }
+    root = new_index[root];
+    n_nodes = n_placed;
+
+    if(mapped_file != NULL)
+        munmap(mapped_file, mapped_size);
+    else {
+        free(tree);
+        free(centers);
+        free(tree_points);
+    }
+    tree = NULL;
+    centers = NULL;
+    tree_points = NULL;
+    free(children);
+    children = NULL;
+    free(new_index);
+    free(old_index);
+}
+
+
+double distance(coord_t *pt1, coord_t *pt2)
+{
+    return sqrt(point_kernels.sq_distance(pt1, pt2));
+}
+
+
+/*
+Calls offer for every point of leaf idx with its squared distance to point, working out the distances of LEAF_BLOCK
+points at a time with the vectorized kernel. The point of a leaf of a single point is its center, already at
+squared distance sq_dist
+*/
+void scan_leaf(long idx, coord_t *point, double sq_dist, void (*offer)(void *search, double sq_dist, long idx), void *search)
+{
+    double dists[LEAF_BLOCK];
+    long first = NODE(idx)->R;
+    long n = -NODE(idx)->L;
+
+    if(n == 1){
+        offer(search, sq_dist, first);
+        return;
+    }
+    for(long i = 0; i < n; i += LEAF_BLOCK){
+        long block = n - i < LEAF_BLOCK ? n - i : LEAF_BLOCK;
+        point_kernels.sq_distances(POINT(first + i), block, point, dists);
+        for(long j = 0; j < block; j++)
+            offer(search, dists[j], first + i + j);
+    }
+}
+
+/*
+Returns the squared distance a child of radius child_radius must be under to hold a point closer than the points
+at distance bound, whose square is sq_bound. Points are compared with sq_bound itself, so ties are not lost to rounding
+*/
+double child_bound(double bound, double sq_bound, double child_radius)
+{
+    if(child_radius == 0.0)
+        return sq_bound;
+    bound += child_radius;
+    return bound * bound;
+}
+
+/*
+Offers point idx at squared distance sq_dist to a nearest neighbor search. Equally close points are resolved to the lowest index
+*/
+void nearest_offer(void *nearest_search, double sq_dist, long idx)
+{
+    search_t *search = nearest_search;
+
+    for(long e = 0; e < search->n_excluded; e++)
+        if(search->excluded[e] == idx)
+            return;
+    if(sq_dist < search->minSqDist || (sq_dist == search->minSqDist && idx < search->currBest)){
+        search->minSqDist = sq_dist;
+        search->minDist = sqrt(sq_dist);
+        search->currBest = idx;
+    }
+}
+
+/*
+Finds the point closest to the search point in the subtree at idx, whose center is at squared distance sq_dist.
+The children are visited nearest center first. Each child is skipped when its ball, of its own radius,
+is entirely beyond the closest point found so far; its distance is compared squared and stops being
+added up once it exceeds that bound
+*/
+void search_tree(search_t *search, long idx, double sq_dist)
+{
+    long child[2];
+    double child_dist[2];
+    int first;
+
+    search->visits++;
+    if(NODE(idx)->L < 0){   // found leave
+        scan_leaf(idx, search->point, sq_dist, nearest_offer, search);
+        return;
+    }
+
+    child[0] = NODE(idx)->L;
+    child[1] = NODE(idx)->R;
+    for(int c = 0; c < 2; c++)
+        child_dist[c] = point_kernels.sq_distance_bounded(NODE(child[c])->center, search->point,
+                                                          child_bound(search->minDist, search->minSqDist, NODE(child[c])->radius));
+    first = child_dist[1] < child_dist[0];
+    for(int i = 0; i < 2; i++){
+        int c = first ^ i;
+        // the bound only shrinks, so a partial distance over the earlier bound is still over it
+        if(child_dist[c] <= child_bound(search->minDist, search->minSqDist, NODE(child[c])->radius))
+            search_tree(search, child[c], child_dist[c]);
+    }
+}
+
+/*
+Returns the index of the point closest to query, adding the nodes visited to visits
+*/
+long nearest_neighbor(coord_t *query, long *visits)
+{
+    // tree is global and only read, so searches can run concurrently
+    search_t search = {
+        .point = query,
+        .minSqDist = HUGE_VAL,
+        .minDist = HUGE_VAL,
+        .currBest = -1,
+        .excluded = NULL,
+        .n_excluded = 0,
+        .visits = 0
+    };
+    search_tree(&search, root, point_kernels.sq_distance(NODE(root)->center, query));
+    *visits += search.visits;
+    return search.currBest;
+}
+
+/*
+Orders neighbors by distance, and by index on ties so the order does not depend on the order of the search
+*/
+int neighbor_greater(neighbor_t *a, neighbor_t *b)
+{
+    return a->dist > b->dist || (a->dist == b->dist && a->idx > b->idx);
+}
+
+/*
+Restores the max-heap property of heap from position i down
+*/
+void heap_sift_down(neighbor_t *heap, long size, long i)
+{
+    neighbor_t tmp;
+    long largest;
+
+    for(;;){
+        largest = i;
+        if(2 * i + 1 < size && neighbor_greater(&heap[2 * i + 1], &heap[largest]))
+            largest = 2 * i + 1;
+        if(2 * i + 2 < size && neighbor_greater(&heap[2 * i + 2], &heap[largest]))
+            largest = 2 * i + 2;
+        if(largest == i)
+            return;
+        tmp = heap[i];
+        heap[i] = heap[largest];
+        heap[largest] = tmp;
+        i = largest;
+    }
+}
+
+/*
+Offers point idx at squared distance dist to the k closest points of a k nearest neighbors search
+*/
+void knn_offer(void *knn_search, double dist, long idx)
+{
+    knn_search_t *search = knn_search;
+    neighbor_t candidate = { .dist = dist, .idx = idx };
+    neighbor_t tmp;
+    long i;
+
+    if(search->size < search->k){
+        // push and sift up
+        i = search->size++;
+        search->heap[i] = candidate;
+        while(i > 0 && neighbor_greater(&search->heap[i], &search->heap[(i - 1) / 2])){
+            tmp = search->heap[i];
+            search->heap[i] = search->heap[(i - 1) / 2];
+            search->heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+        if(search->size == search->k)
+            search->kth_dist = sqrt(search->heap[0].dist);
+        return;
+    }
+    if(neighbor_greater(&search->heap[0], &candidate)){
+        search->heap[0] = candidate;
+        heap_sift_down(search->heap, search->size, 0);
+        search->kth_dist = sqrt(search->heap[0].dist);
+    }
+}
+
+/*
+Returns the squared distance a point must be under to be one of the k closest: the k-th one found so far
+*/
+double knn_bound(knn_search_t *search)
+{
+    return search->size < search->k ? HUGE_VAL : search->heap[0].dist;
+}
+
+/*
+Searches the subtree at idx, whose center is at squared distance sq_dist, for points closer than the current
+k-th distance. As in search_tree, the children are visited nearest center first and each one is skipped when
+its ball, of its own radius, is entirely beyond that distance
+*/
+void knn_search_tree(knn_search_t *search, long idx, double sq_dist)
+{
+    long child[2];
+    double child_dist[2];
+    int first;
+
+    search->visits++;
+    if(NODE(idx)->L < 0){   // found leave
+        scan_leaf(idx, search->point, sq_dist, knn_offer, search);
+        return;
+    }
+
+    child[0] = NODE(idx)->L;
+    child[1] = NODE(idx)->R;
+    for(int c = 0; c < 2; c++)
+        child_dist[c] = point_kernels.sq_distance_bounded(NODE(child[c])->center, search->point,
+                                                          child_bound(search->kth_dist, knn_bound(search), NODE(child[c])->radius));
+    first = child_dist[1] < child_dist[0];
+    for(int i = 0; i < 2; i++){
+        int c = first ^ i;
+        if(child_dist[c] <= child_bound(search->kth_dist, knn_bound(search), NODE(child[c])->radius))
+            knn_search_tree(search, child[c], child_dist[c]);
+    }
+}
+
+/*
+Places in out the k points closest to query, sorted by distance, and returns how many there are
+(fewer than k only if the tree has fewer points). Adds the nodes visited to visits
+*/
+long k_nearest_neighbors(coord_t *query, long k, neighbor_t *out, long *visits)
+{
+    neighbor_t tmp;
+    knn_search_t search = {
+        .point = query,
+        .heap = out,
+        .size = 0,
+        .k = k,
+        .kth_dist = HUGE_VAL,
+        .visits = 0
+    };
+    knn_search_tree(&search, root, point_kernels.sq_distance(NODE(root)->center, query));
+    *visits += search.visits;
+
+    // heap sort: move the largest to the end of the shrinking heap
+    for(long size = search.size; size > 1; size--){
+        tmp = out[0];
+        out[0] = out[size - 1];
+        out[size - 1] = tmp;
+        heap_sift_down(out, size - 1, 0);
+    }
+    for(long i = 0; i < search.size; i++)
+        out[i].dist = sqrt(out[i].dist);
+    return search.size;
 }
 
+/*
+Same as k_nearest_neighbors with k nearest neighbor searches, each skipping the points found by the previous ones.
+Used as the baseline of the k nearest neighbors benchmark
+*/
+long k_nearest_neighbors_by_passes(coord_t *query, long k, neighbor_t *out, long *visits)
+{
+    long *excluded = (long *) malloc(k * sizeof(long));
+    if(excluded == NULL){
+        printf("Error allocating search, exiting.\n");
+        exit(4);
+    }
+    search_t search = {
+        .point = query,
+        .excluded = excluded,
+        .n_excluded = 0,
+        .visits = 0
+    };
 
-double distance(double *pt1, double *pt2)
+    for(long i = 0; i < k; i++){
+        search.minSqDist = HUGE_VAL;
+        search.minDist = HUGE_VAL;
+        search.currBest = -1;
+        search_tree(&search, root, point_kernels.sq_distance(NODE(root)->center, query));
+        if(search.currBest < 0)
+            break;
+        out[i].dist = search.minDist;
+        out[i].idx = search.currBest;
+        excluded[search.n_excluded++] = search.currBest;
+    }
+    free(excluded);
+    *visits += search.visits;
+    return search.n_excluded;
+}
+
+/*
+Places in out the answer to query: the closest point if k is 0, or the k closest ones. Returns the number of points
+and adds the nodes visited to visits
+*/
+long answer_query(coord_t *query, long k, neighbor_t *out, long *visits)
 {
-    double dist = 0.0;
+    if(k == 0){
+        out[0].idx = nearest_neighbor(query, visits);
+        return 1;
+    }
+    if(query_options.knn_by_passes)
+        return k_nearest_neighbors_by_passes(query, k, out, visits);
+    return k_nearest_neighbors(query, k, out, visits);
+}
 
+void print_point(FILE *out, long idx)
+{
     for(int d = 0; d < n_dims; d++)
-        dist += (pt1[d] - pt2[d]) * (pt1[d] - pt2[d]);
-    return sqrt(dist);
+        fprintf(out, "%lf ", POINT(idx)[d]);
+    fprintf(out, "\n");
 }
 
+/*
+Emits every point of the subtree at idx, which lies entirely inside the query sphere, without testing them
+*/
+void emit_subtree(range_search_t *search, long idx)
+{
+    search->visits++;
+    if(NODE(idx)->L < 0){
+        for(long i = NODE(idx)->R; i < NODE(idx)->R - NODE(idx)->L; i++)
+            search->emit(search, i);
+        return;
+    }
+    emit_subtree(search, NODE(idx)->L);
+    emit_subtree(search, NODE(idx)->R);
+}
 
-void search_tree(long idx)
+/*
+Emits point idx at squared distance sq_dist if it is within the query radius
+*/
+void range_offer(void *range_search, double sq_dist, long idx)
 {
-    double dist;
-    long idxl, idxr;
+    range_search_t *search = range_search;
 
-    if(tree[idx].radius == 0.0){   // found leave
-        dist = distance(center[idx], point);
-        if(dist < minDist){
-            minDist = dist;
-            currBest = idx;
+    if(sqrt(sq_dist) <= search->radius)
+        search->emit(search, idx);
+}
+
+/*
+Emits the points of the subtree at idx within the query radius of the query point.
+Subtrees whose ball is inside the query sphere are emitted whole and the ones whose ball is disjoint from it
+are skipped, so only the balls crossing the sphere are opened. Leaves of a single point have radius 0, so they are
+always one or the other, the points of the other leaves crossing the sphere are tested one by one
+*/
+void range_search_tree(range_search_t *search, long idx)
+{
+    double dist = distance(NODE(idx)->center, search->point);
+
+    search->visits++;
+    if(dist - NODE(idx)->radius > search->radius)    // disjoint
+        return;
+    if(dist + NODE(idx)->radius <= search->radius){  // inside
+        search->visits--;   // counted again by emit_subtree
+        emit_subtree(search, idx);
+        return;
+    }
+    if(NODE(idx)->L < 0){
+        scan_leaf(idx, search->point, dist * dist, range_offer, search);
+        return;
+    }
+    range_search_tree(search, NODE(idx)->L);
+    range_search_tree(search, NODE(idx)->R);
+}
+
+void emit_print(range_search_t *search, long idx)
+{
+    print_point(stdout, idx);
+}
+
+void emit_collect(range_search_t *search, long idx)
+{
+    if(search->n_found == search->capacity){
+        search->capacity = search->capacity ? 2 * search->capacity : 64;
+        search->found = (long *) realloc(search->found, search->capacity * sizeof(long));
+        if(search->found == NULL){
+            printf("Error allocating range query results, exiting.\n");
+            exit(4);
         }
+    }
+    search->found[search->n_found++] = idx;
+}
+
+/*
+Runs the range query of query_options.radius around query, calling emit for every point in range.
+The nodes visited are counted in search->visits
+*/
+void range_query(coord_t *query, range_search_t *search, void (*emit)(range_search_t *search, long idx))
+{
+    search->point = query;
+    search->radius = query_options.radius;
+    search->emit = emit;
+    search->n_found = 0;
+    search->visits = 0;
+    range_search_tree(search, root);
+}
+
+/*
+Prints to out an answer of answer_query for k: the closest sample if k is 0,
+or one line per neighbor with its coordinates and distance
+*/
+void print_answer(FILE *out, neighbor_t *answer, long n_neighbors, long k)
+{
+    if(k == 0){
+        print_point(out, answer[0].idx);
         return;
     }
-    
-    idxl = hash_get_index(tree[idx].L);
-    if(distance(center[idxl], point) - tree[idx].radius < minDist)
-        search_tree(idxl);
-    idxr = hash_get_index(tree[idx].R);
-    if(distance(center[idxr], point) - tree[idx].radius < minDist)
-        search_tree(idxr);
+    for(long i = 0; i < n_neighbors; i++){
+        for(int d = 0; d < n_dims; d++)
+            fprintf(out, "%lf ", POINT(answer[i].idx)[d]);
+        fprintf(out, "%lf\n", answer[i].dist);
+    }
 }
 
-int main(int argc, char *argv[])
+/*
+Reads up to max_queries query points from a text query file, n_dims numbers per point separated by whitespace.
+Returns how many were read
+*/
+long read_text_queries(FILE *fp, coord_t *queries, long max_queries)
 {
-    FILE *fp;
-    node_t *node;
-    long i,
-	 node_idx;
+    double coord;
+    long n;
     int d;
 
-    if(argc < 3){
-        printf("Usage: %s <ball-tree-file> <point>\n", argv[0]);
-        exit(1);
+    for(n = 0; n < max_queries; n++){
+        for(d = 0; d < n_dims; d++){
+            if(fscanf(fp, "%lf", &coord) != 1){
+                if(d != 0){
+                    printf("Query %ld has %d coordinates, expected %d.\n", n, d, n_dims);
+                    exit(6);
+                }
+                return n;
+            }
+            queries[n * n_dims + d] = coord;
+        }
     }
+    return n;
+}
+
+/*
+Reads up to max_queries query points from a binary points file with coordinates of coord_size bytes.
+Returns how many were read
+*/
+long read_binary_queries(FILE *fp, int coord_size, coord_t *queries, long max_queries)
+{
+    long n;
+
+    if(coord_size == sizeof(coord_t))
+        return fread(queries, n_dims * sizeof(coord_t), max_queries, fp);
+
+    char buffer[n_dims * coord_size];
+    for(n = 0; n < max_queries && fread(buffer, n_dims * coord_size, 1, fp) == 1; n++){
+        for(int d = 0; d < n_dims; d++)
+            queries[n * n_dims + d] = coord_size == sizeof(float) ? ((float *) buffer)[d] : ((double *) buffer)[d];
+    }
+    return n;
+}
 
-    fp = fopen(argv[1], "r");
+/*
+Answers the nearest neighbor queries of a block with the OpenMP threads, then prints the answers in input order.
+Returns the number of nodes visited
+*/
+long answer_neighbor_block(coord_t *queries, long n_queries, neighbor_t *answers, long answer_size, long *n_neighbors)
+{
+    long visits = 0;
+    long chunk = n_queries >= QUERY_CHUNK * omp_get_max_threads() ? QUERY_CHUNK : 1;  // small blocks still use every thread
+
+    #pragma omp parallel for schedule(dynamic, chunk) reduction(+:visits)
+    for(long q = 0; q < n_queries; q++)
+        n_neighbors[q] = answer_query(&queries[q * n_dims], query_options.k, &answers[q * answer_size], &visits);
+
+    for(long q = 0; q < n_queries; q++)
+        print_answer(stdout, &answers[q * answer_size], n_neighbors[q], query_options.k);
+    return visits;
+}
+
+/*
+Answers the range queries of a block, printing the points in range of each query followed by an empty line.
+With a single thread they are printed as they are found. Otherwise the threads collect the points of each query,
+which are printed in input order once the block is done. Returns the number of nodes visited
+*/
+long answer_range_block(coord_t *queries, long n_queries, range_search_t *searches)
+{
+    long visits = 0;
+
+    if(omp_get_max_threads() == 1){
+        for(long q = 0; q < n_queries; q++){
+            range_query(&queries[q * n_dims], &searches[0], emit_print);
+            visits += searches[0].visits;
+            printf("\n");
+        }
+        return visits;
+    }
+
+    #pragma omp parallel for schedule(dynamic, QUERY_CHUNK) reduction(+:visits)
+    for(long q = 0; q < n_queries; q++){
+        range_query(&queries[q * n_dims], &searches[q], emit_collect);
+        visits += searches[q].visits;
+    }
+
+    for(long q = 0; q < n_queries; q++){
+        for(long i = 0; i < searches[q].n_found; i++)
+            print_point(stdout, searches[q].found[i]);
+        printf("\n");
+    }
+    return visits;
+}
+
+/*
+Answers every query point in the file at path ("-" for stdin), printing the answer of each one as in single queries
+(range queries followed by an empty line).
+The queries are read in blocks of QUERY_BLOCK, or of as many as have QUERY_BLOCK_ANSWERS neighbors in all with a large k,
+so the answers take bounded memory. Each block is answered by the OpenMP threads,
+which take QUERY_CHUNK queries at a time, before the answers are printed in input order.
+Binary points files (see points_format.h) are detected by their magic, anything else is read as text.
+The number of queries per second and the average number of tree nodes visited per query are reported to stderr
+*/
+void batch_queries(char *path)
+{
+    struct points_file_header header;
+    double exec_time;
+    coord_t *queries;
+    neighbor_t *answers;
+    long *n_neighbors;
+    range_search_t *searches;
+    long answer_size = query_options.k ? query_options.k : 1;
+    long block_size = QUERY_BLOCK_ANSWERS / answer_size;  // queries read and answered at a time
+    long n_queries = 0;
+    long visits = 0;
+    long n_read;
+    int binary = 0;
+    int c;
+    FILE *fp;
+
+    fp = strcmp(path, "-") ? fopen(path, "rb") : stdin;
     if(fp == NULL){
-        printf("Cannot open input file '%s'.\n", argv[1]);
+        printf("Cannot open query file '%s'.\n", path);
         exit(2);
     }
 
-    fscanf(fp, "%d %ld", &n_dims, &n_nodes);
-    if(n_dims < 2){
-        printf("Illegal number of dimensions (%d), must be above 1.\n", n_dims);
-        exit(3);
+    c = getc(fp);
+    ungetc(c, fp);
+    if(c == POINTS_FILE_MAGIC[0]){
+        if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, POINTS_FILE_MAGIC, POINTS_FILE_MAGIC_SIZE)){
+            printf("Invalid binary query file '%s'.\n", path);
+            exit(6);
+        }
+        if(header.version != POINTS_FILE_VERSION || header.n_dims != n_dims ||
+           (header.coord_size != sizeof(float) && header.coord_size != sizeof(double))){
+            printf("Binary query file '%s' has version %d, %ld dimensions and %d byte coordinates, expected version %d and %d dimensions.\n",
+                   path, header.version, (long) header.n_dims, header.coord_size, POINTS_FILE_VERSION, n_dims);
+            exit(6);
+        }
+        binary = 1;
     }
-    if(n_nodes < 2){
-        printf("Illegal number of nodes (%ld), must be above 1.\n", n_nodes);
-        exit(2);
+
+    if(block_size > QUERY_BLOCK)
+        block_size = QUERY_BLOCK;
+    if(block_size < 1)
+        block_size = 1;
+    queries = (coord_t *) malloc(block_size * n_dims * sizeof(coord_t));
+    answers = (neighbor_t *) malloc(block_size * answer_size * sizeof(neighbor_t));
+    n_neighbors = (long *) malloc(block_size * sizeof(long));
+    searches = (range_search_t *) calloc(block_size, sizeof(range_search_t));
+    if(queries == NULL || answers == NULL || n_neighbors == NULL || searches == NULL){
+        printf("Error allocating queries, exiting.\n");
+        exit(4);
+    }
+
+    exec_time = -omp_get_wtime();
+    do {
+        n_read = binary ? read_binary_queries(fp, header.coord_size, queries, block_size)
+                        : read_text_queries(fp, queries, block_size);
+
+        if(query_options.radius >= 0)
+            visits += answer_range_block(queries, n_read, searches);
+        else
+            visits += answer_neighbor_block(queries, n_read, answers, answer_size, n_neighbors);
+        n_queries += n_read;
+    } while(n_read == block_size);
+    fflush(stdout);
+    exec_time += omp_get_wtime();
+
+    fprintf(stderr, "%ld queries in %.3f s (%.0f queries/s, %d threads, %.1f nodes visited per query)\n",
+            n_queries, exec_time, n_queries / exec_time, omp_get_max_threads(), n_queries ? (double) visits / n_queries : 0.0);
+
+    if(fp != stdin)
+        fclose(fp);
+    for(long q = 0; q < block_size; q++)
+        free(searches[q].found);
+    free(queries);
+    free(answers);
+    free(n_neighbors);
+    free(searches);
+}
+
+volatile sig_atomic_t server_stop = 0;  // set by SIGINT and SIGTERM
+
+void stop_server(int signal)
+{
+    server_stop = 1;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+Prints the number of requests answered by the server and the percentiles of the latencies of the latest ones,
+from reading their line to writing their reply, or queuing it for a client that is not reading
+*/
+void print_latency_stats(server_t *server, FILE *out)
+{
+    static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+    static const char *names[] = { "p50", "p90", "p99", "p99.9", "max" };
+    long n = server->n_answered < LATENCY_WINDOW ? server->n_answered : LATENCY_WINDOW;
+    double sorted[n > 0 ? n : 1];
+
+    fprintf(out, "%ld requests", server->n_answered);
+    if(n > 0){
+        memcpy(sorted, server->latencies, n * sizeof(double));
+        qsort(sorted, n, sizeof(double), compare_doubles);
+        fprintf(out, ", latency");
+        for(int i = 0; i < 5; i++)
+            fprintf(out, " %s %.1f", names[i], 1e6 * sorted[(long) ceil(percentiles[i] / 100.0 * n) - 1]);
+        fprintf(out, " us");
     }
+    fprintf(out, "\n");
+}
+
+void add_client(server_t *server, int fd, int out_fd)
+{
+    client_t *client = &server->clients[server->n_clients++];
 
-    if(argc != n_dims + 2){
+    client->fd = fd;
+    client->out_fd = out_fd;
+    client->out = NULL;
+    client->output = NULL;
+    client->output_size = 0;
+    client->output_sent = 0;
+    client->buffer = NULL;
+    client->size = 0;
+    client->capacity = 0;
+    client->closed = 0;
+    client->discarding = 0;
+}
+
+/*
+Reads what client sent into its buffer, marking it closed at the end of file.
+A last line without a newline is completed so it is still answered.
+While the rest of a line that was too long is being dropped, what comes before its newline is discarded.
+A client whose buffer cannot grow is disconnected, the server keeps serving the others
+*/
+void read_client(client_t *client)
+{
+    ssize_t n_read;
+    char *newline;
+    char *buffer;
+
+    if(client->capacity - client->size < SERVER_READ_SIZE){
+        buffer = (char *) realloc(client->buffer, 2 * (client->size + SERVER_READ_SIZE));
+        if(buffer == NULL){
+            client->closed = 1;
+            client->size = 0;
+            return;
+        }
+        client->buffer = buffer;
+        client->capacity = 2 * (client->size + SERVER_READ_SIZE);
+    }
+    n_read = read(client->fd, client->buffer + client->size, SERVER_READ_SIZE);
+    if(n_read < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if(n_read <= 0){
+        client->closed = 1;
+        if(client->size > 0 && client->buffer[client->size - 1] != '\n')
+            client->buffer[client->size++] = '\n';
+        return;
+    }
+    if(client->discarding){
+        newline = memchr(client->buffer + client->size, '\n', n_read);
+        if(newline == NULL)
+            return;
+        client->discarding = 0;
+        n_read -= newline + 1 - (client->buffer + client->size);
+        memmove(client->buffer + client->size, newline + 1, n_read);
+    }
+    client->size += n_read;
+}
+
+/*
+Parses the request line from line to end, the point of a query going to query.
+k is limited to the number of points of the tree, which bounds the answers of the request
+*/
+void parse_request(const char *line, const char *end, request_t *request, coord_t *query)
+{
+    const char *p = skip_blanks(line, end);
+    double coord;
+
+    request->k = query_options.k;
+    request->kind = REQUEST_ERROR;
+    if(end - p >= 5 && !memcmp(p, "stats", 5) && skip_blanks(p + 5, end) == end){
+        request->kind = REQUEST_STATS;
+        return;
+    }
+    if(end - p >= 2 && p[0] == 'k' && (p[1] == ' ' || p[1] == '\t')){
+        p++;
+        if(!scan_long(&p, end, &request->k))
+            return;
+        if(request->k < 1 || request->k > n_points){
+            request->kind = REQUEST_BAD_K;
+            return;
+        }
+    }
+    for(int d = 0; d < n_dims; d++){
+        if(!scan_double(&p, end, &coord))
+            return;
+        query[d] = coord;
+    }
+    if(skip_blanks(p, end) == end)
+        request->kind = REQUEST_QUERY;
+}
+
+/*
+Adds the whole request lines of client to the batch of the server, while it has room for them,
+and an error for a line that grew longer than SERVER_MAX_LINE without ending.
+Returns whether whole lines are left for a later batch
+*/
+int take_requests(server_t *server, client_t *client, double now)
+{
+    char *line = client->buffer;
+    char *end = client->buffer + client->size;
+    char *newline;
+    request_t *request;
+
+    while(server->n_requests < QUERY_BLOCK && (newline = memchr(line, '\n', end - line)) != NULL){
+        if(skip_blanks(line, newline) != newline){   // blank lines are skipped
+            request = &server->requests[server->n_requests];
+            request->client = client;
+            request->received = now;
+            parse_request(line, newline, request, &server->queries[server->n_requests * n_dims]);
+            server->n_requests++;
+        }
+        line = newline + 1;
+    }
+    client->size = end - line;
+    memmove(client->buffer, line, client->size);
+    if(memchr(client->buffer, '\n', client->size) != NULL)
+        return 1;
+    // a line that is still not whole after SERVER_MAX_LINE bytes is answered now and the rest of it is dropped
+    if(client->size > SERVER_MAX_LINE && server->n_requests < QUERY_BLOCK){
+        request = &server->requests[server->n_requests++];
+        request->client = client;
+        request->received = now;
+        request->kind = REQUEST_TOO_LONG;
+        client->size = 0;
+        client->discarding = 1;
+    }
+    return 0;
+}
+
+/*
+Returns the memory stream the replies of the batch to client are written to, opening it at its first reply
+*/
+FILE *client_replies(client_t *client)
+{
+    if(client->out == NULL){
+        client->out = open_memstream(&client->reply, &client->reply_size);
+        if(client->out == NULL){
+            printf("Error allocating replies, exiting.\n");
+            exit(4);
+        }
+    }
+    return client->out;
+}
+
+/*
+Adds the replies of the batch to the output of client
+*/
+void queue_replies(client_t *client)
+{
+    char *output;
+
+    if(client->out == NULL)
+        return;
+    fclose(client->out);
+    client->out = NULL;
+    if(client->output_sent == client->output_size){
+        free(client->output);
+        client->output = client->reply;
+        client->output_size = client->reply_size;
+        client->output_sent = 0;
+        return;
+    }
+    output = (char *) realloc(client->output, client->output_size + client->reply_size);
+    if(output == NULL){   // the client is disconnected, the server keeps serving the others
+        client->closed = 1;
+        client->size = 0;
+        client->output_sent = client->output_size;
+    }
+    else{
+        memcpy(output + client->output_size, client->reply, client->reply_size);
+        client->output = output;
+        client->output_size += client->reply_size;
+    }
+    free(client->reply);
+}
+
+/*
+Writes the output of client until it is all written or the socket of the client is full.
+A client that cannot be written to any more is closed, dropping its output and requests
+*/
+void flush_client(client_t *client)
+{
+    ssize_t n_written;
+
+    while(client->output_sent < client->output_size){
+        n_written = write(client->out_fd, client->output + client->output_sent, client->output_size - client->output_sent);
+        if(n_written < 0 && errno == EINTR)
+            continue;
+        if(n_written < 0 && errno == EAGAIN)
+            return;
+        if(n_written < 0){
+            client->closed = 1;
+            client->size = 0;
+            break;
+        }
+        client->output_sent += n_written;
+    }
+    free(client->output);
+    client->output = NULL;
+    client->output_size = 0;
+    client->output_sent = 0;
+}
+
+/*
+Answers the batch of requests of the server with the OpenMP threads, writes the replies in the order of the requests
+and sends them to the clients, queuing what a client is not ready to read. Every reply ends with an empty line
+*/
+void answer_requests(server_t *server)
+{
+    long n_answers = 0;
+    long visits = 0;
+    double now;
+
+    for(long r = 0; r < server->n_requests; r++){
+        server->requests[r].first_answer = n_answers;
+        if(server->requests[r].kind == REQUEST_QUERY)
+            n_answers += server->requests[r].k ? server->requests[r].k : 1;
+    }
+    if(n_answers > server->answers_capacity){
+        neighbor_t *answers = (neighbor_t *) realloc(server->answers, 2 * n_answers * sizeof(neighbor_t));
+        if(answers != NULL){
+            server->answers = answers;
+            server->answers_capacity = 2 * n_answers;
+        }
+        else{
+            // the server keeps running, the queries of the batch are answered with an error
+            for(long r = 0; r < server->n_requests; r++)
+                if(server->requests[r].kind == REQUEST_QUERY)
+                    server->requests[r].kind = REQUEST_NO_MEMORY;
+        }
+    }
+
+    // one request per thread at a time, the batches are often small
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:visits)
+    for(long r = 0; r < server->n_requests; r++){
+        request_t *request = &server->requests[r];
+        if(request->kind == REQUEST_QUERY)
+            request->n_neighbors = answer_query(&server->queries[r * n_dims], request->k,
+                                                &server->answers[request->first_answer], &visits);
+    }
+
+    for(long r = 0; r < server->n_requests; r++){
+        request_t *request = &server->requests[r];
+        FILE *out = client_replies(request->client);
+        if(request->kind == REQUEST_QUERY)
+            print_answer(out, &server->answers[request->first_answer], request->n_neighbors, request->k);
+        else if(request->kind == REQUEST_STATS)
+            print_latency_stats(server, out);
+        else if(request->kind == REQUEST_BAD_K)
+            fprintf(out, "error: k must be between 1 and the %ld points of the tree\n", n_points);
+        else if(request->kind == REQUEST_NO_MEMORY)
+            fprintf(out, "error: out of memory for the answers\n");
+        else if(request->kind == REQUEST_TOO_LONG)
+            fprintf(out, "error: line too long\n");
+        else
+            fprintf(out, "error: expected [k <n>] and %d coordinates, or stats\n", n_dims);
+        fprintf(out, "\n");
+    }
+    for(int c = 0; c < server->n_clients; c++){
+        queue_replies(&server->clients[c]);
+        flush_client(&server->clients[c]);
+    }
+
+    now = omp_get_wtime();
+    for(long r = 0; r < server->n_requests; r++)
+        server->latencies[server->n_answered++ % LATENCY_WINDOW] = now - server->requests[r].received;
+    server->n_requests = 0;
+}
+
+/*
+Closes the clients that reached the end of file and have no requests or output left
+*/
+void remove_closed_clients(server_t *server)
+{
+    int kept = 0;
+
+    for(int c = 0; c < server->n_clients; c++){
+        client_t *client = &server->clients[c];
+        if(!client->closed || memchr(client->buffer, '\n', client->size) != NULL || client->output_size > 0){
+            server->clients[kept++] = *client;
+            continue;
+        }
+        if(client->fd != STDIN_FILENO)
+            close(client->fd);
+        free(client->buffer);
+    }
+    server->n_clients = kept;
+}
+
+/*
+Listens for clients on the Unix domain socket at path, replacing any file there
+*/
+int listen_unix_socket(char *path)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    int fd;
+
+    if(strlen(path) >= sizeof(address.sun_path)){
+        printf("Socket path '%s' is too long.\n", path);
+        exit(7);
+    }
+    strcpy(address.sun_path, path);
+    unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0){
+        printf("Cannot listen on socket '%s'.\n", path);
+        exit(7);
+    }
+    return fd;
+}
+
+/*
+Serves queries until stdin ends ("-") or, on the Unix domain socket at path, until SIGINT or SIGTERM.
+Every request is a line with the n_dims coordinates of a point, answered as single queries are (the k nearest
+neighbors of -k), or "k <n>" followed by the coordinates to ask for the n nearest neighbors. "stats" replies with
+the latency percentiles. Each reply ends with an empty line.
+Every round waits for requests, takes all the whole lines received from every client (up to QUERY_BLOCK), answers
+them with the OpenMP threads and writes the replies. Sockets are not blocking: the replies a client does not read yet
+are queued and written as it reads them, and its requests wait until then, so a slow client only holds up itself.
+The latency percentiles are also reported to stderr at the end
+*/
+void serve_queries(char *path)
+{
+    struct sigaction action = { .sa_handler = stop_server };  // no SA_RESTART, so poll is interrupted
+    struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+    server_t server = { .listen_fd = -1 };
+    client_t *client;
+    int pending = 0;
+    int listening;
+    int n_polled;
+    int n_fds;
+    int fd;
+
+    server.requests = (request_t *) malloc(QUERY_BLOCK * sizeof(request_t));
+    server.queries = (coord_t *) malloc(QUERY_BLOCK * n_dims * sizeof(coord_t));
+    server.latencies = (double *) malloc(LATENCY_WINDOW * sizeof(double));
+    if(server.requests == NULL || server.queries == NULL || server.latencies == NULL){
+        printf("Error allocating server, exiting.\n");
+        exit(4);
+    }
+
+    signal(SIGPIPE, SIG_IGN);  // replies to clients that left fail instead of killing the server
+    if(strcmp(path, "-")){
+        server.listen_fd = listen_unix_socket(path);
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+    }
+    else
+        add_client(&server, STDIN_FILENO, STDOUT_FILENO);
+    fprintf(stderr, "Serving %ld nodes on %s\n", n_nodes, strcmp(path, "-") ? path : "stdin");
+
+    while(!server_stop){
+        // while the client table is full, connections wait in the backlog instead of waking up poll
+        listening = server.listen_fd >= 0 && server.n_clients < SERVER_MAX_CLIENTS;
+        n_fds = 0;
+        if(listening)
+            fds[n_fds++] = (struct pollfd) { .fd = server.listen_fd, .events = POLLIN };
+        // clients with output left are waited on until they can take more of it, and are not read meanwhile
+        n_polled = server.n_clients;
+        for(int c = 0; c < n_polled; c++){
+            client = &server.clients[c];
+            if(client->output_size > 0)
+                fds[n_fds++] = (struct pollfd) { .fd = client->out_fd, .events = POLLOUT };
+            else
+                fds[n_fds++] = (struct pollfd) { .fd = client->closed ? -1 : client->fd, .events = POLLIN };
+        }
+
+        // lines left over from a full batch are answered without waiting
+        if(poll(fds, n_fds, pending ? 0 : -1) < 0){
+            if(errno == EINTR)
+                continue;
+            printf("Error waiting for requests.\n");
+            exit(7);
+        }
+
+        n_fds = 0;
+        if(listening && (fds[n_fds++].revents & POLLIN)){
+            fd = accept(server.listen_fd, NULL, NULL);
+            // replies are written without blocking, so a client that does not read them cannot stall the others
+            if(fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0)
+                add_client(&server, fd, fd);
+            else if(fd >= 0)
+                close(fd);
+        }
+        for(int c = 0; c < n_polled; c++){
+            client = &server.clients[c];
+            if(!(fds[n_fds++].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)))
+                continue;
+            if(client->output_size > 0)
+                flush_client(client);
+            else
+                read_client(client);
+        }
+
+        pending = 0;
+        for(int c = 0; c < server.n_clients; c++)
+            if(server.clients[c].output_size == 0)
+                pending |= take_requests(&server, &server.clients[c], omp_get_wtime());
+        if(server.n_requests > 0)
+            answer_requests(&server);
+        remove_closed_clients(&server);
+
+        if(server.listen_fd < 0 && server.n_clients == 0)   // stdin ended
+            break;
+    }
+
+    if(server.listen_fd >= 0){
+        close(server.listen_fd);
+        unlink(path);
+    }
+    print_latency_stats(&server, stderr);
+}
+
+void usage(char *program)
+{
+    printf("Usage: %s <ball-tree-file> [-k <n> | -r <radius>] <point>\n", program);
+    printf("       %s <ball-tree-file> [-k <n> [--knn-by-passes] | -r <radius>] --batch <query-file|->\n", program);
+    printf("       %s <ball-tree-file> [-k <n>] --serve <socket-path|->\n", program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    char *batch_path = NULL;
+    char *serve_path = NULL;
+    int arg = 2;
+    int d;
+
+    if(argc < 3)
+        usage(argv[0]);
+
+    // options come before the point, whose negative coordinates also start with '-'
+    for(; arg < argc; arg++){
+        if(!strcmp(argv[arg], "-k") && arg + 1 < argc){
+            query_options.k = atol(argv[++arg]);
+            if(query_options.k < 1){
+                printf("Illegal number of neighbors (%ld), must be above 0.\n", query_options.k);
+                exit(1);
+            }
+        }
+        else if(!strcmp(argv[arg], "-r") && arg + 1 < argc){
+            query_options.radius = atof(argv[++arg]);
+            if(query_options.radius < 0){
+                printf("Illegal radius (%s), must not be negative.\n", argv[arg]);
+                exit(1);
+            }
+        }
+        else if(!strcmp(argv[arg], "--knn-by-passes"))
+            query_options.knn_by_passes = 1;
+        else if(!strcmp(argv[arg], "--batch") && arg + 1 < argc)
+            batch_path = argv[++arg];
+        else if(!strcmp(argv[arg], "--serve") && arg + 1 < argc)
+            serve_path = argv[++arg];
+        else
+            break;
+    }
+    if((query_options.knn_by_passes && query_options.k == 0) || (query_options.k && query_options.radius >= 0) ||
+       (serve_path != NULL && (batch_path != NULL || query_options.radius >= 0)))
+        usage(argv[0]);
+
+    load_tree(argv[1]);
+
+    if(batch_path == NULL && serve_path == NULL && argc - arg != n_dims){
         printf("Wrong number of coordinates for <point>\n");
         exit(3);
     }
+    if((batch_path != NULL || serve_path != NULL) && arg != argc)
+        usage(argv[0]);
+
+    init_point_kernels(n_dims);
 
-    point = (double *) malloc(n_dims * sizeof(double));
-    if(point == NULL){
+    resolve_children();
+    relayout_tree();
+
+    // there are never more neighbors than points, and k sizes the answers
+    if(query_options.k > n_points)
+        query_options.k = n_points;
+
+    if(batch_path != NULL){
+        batch_queries(batch_path);
+        return 0;
+    }
+    if(serve_path != NULL){
+        serve_queries(serve_path);
+        return 0;
+    }
+
+    coord_t *point = (coord_t *) malloc(n_dims * sizeof(coord_t));
+    neighbor_t *answer = (neighbor_t *) malloc((query_options.k ? query_options.k : 1) * sizeof(neighbor_t));
+    if(point == NULL || answer == NULL){
         printf("Error allocating point, exiting.\n");
         exit(4);
     }
     for(d = 0; d < n_dims; d++)
-        point[d] = atof(argv[d + 2]);
+        point[d] = atof(argv[arg + d]);
 
-    allocate_hash();
-    allocate_tree();
-    for(i = 0; i < n_nodes; i++){
-        fscanf(fp, "%ld", &node_idx);
-	hash_insert(node_idx, i);
-        node = &(tree[i]);
-        fscanf(fp, "%ld %ld %lf", &(node->L), &(node->R), &(node->radius));
-        for(d = 0; d < n_dims; d++)
-            fscanf(fp, "%lf", &(center[i][d]));
+    if(query_options.radius >= 0){
+        // print every sample within the radius as it is found
+        range_search_t search = { 0 };
+        range_query(point, &search, emit_print);
+        return 0;
     }
 
-    // tree and point are global, index 0 is root; currBest has result
-    search_tree(hash_get_index(0));
-    
-    // print closest sample
-    for(d = 0; d < n_dims; d++)
-        printf("%lf ", center[currBest][d]);
-    printf("\n");
+    // print closest sample, or the k closest ones
+    long visits = 0;
+    print_answer(stdout, answer, answer_query(point, query_options.k, answer, &visits), query_options.k);
 }
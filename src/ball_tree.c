@@ -1,30 +1,192 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <omp.h>
 #include "ball_tree.h"
 #include "point_operations.h"
+#include "tree_format.h"
+#include "fixed_format.h"
+#include "macros.h"
+#include "options.h"
 
+#define DUMP_BLOCK 4096 // node records converted and written at a time
+#define TEXT_BLOCK 1024 // node lines formatted by a thread at a time
+#define TEXT_BLOCKS_PER_THREAD 4 // blocks of node lines formatted in parallel before they are written, per thread
+
+typedef struct text_buffer {
+    char* text;
+    long size;
+    long capacity;
+} text_buffer_t;
+
+extern int n_dims;
 extern long node_counter;
 extern node_ptr node_list;
+extern coord_t** leaf_points; // points of the leaves of bucket trees, in the order of the leaves
+extern long leaf_point_counter; // number of points in leaf_points
+extern long leaf_points_offset; // index in the whole tree of the first point in leaf_points
 
 
-node_ptr make_node(long id, double* center, double radius, node_ptr new_node) {
+node_ptr make_node(long id, coord_t* center, double radius, node_ptr new_node) {
     new_node->radius = radius;
     new_node->center = center;
     new_node->id = id;
     new_node->left_id = -1;
     new_node->right_id = -1;
+    new_node->points = NULL;
+    new_node->n_points = 0;
     return new_node;
 }
 
-void print_node(node_ptr node) {
+/*
+Appends the line of node to buffer: the id, the child ids and the radius of the node followed by its center
+and, for the leaves of bucket trees, by its points, in the same format as printf("%ld %ld %ld %.6f") and " %.6f"
+*/
+static void format_node(text_buffer_t* buffer, node_ptr node) {
+    long n_numbers = 4 + n_dims * (1 + node->n_points);
+    long needed = buffer->size + n_numbers * (MAX_NUMBER_TEXT + 1) + 1;
+    if(needed > buffer->capacity) {
+        buffer->capacity = MAX(2 * buffer->capacity, needed);
+        buffer->text = (char*) realloc(buffer->text, buffer->capacity);
+        if(buffer->text == NULL) {
+            fprintf(stderr, "Error allocating the tree output, exiting.\n");
+            exit(10);
+        }
+    }
+
+    char* p = buffer->text + buffer->size;
+    p = format_long(p, node->id);
+    *p++ = ' ';
+    p = format_long(p, node->left_id);
+    *p++ = ' ';
+    p = format_long(p, node->right_id);
+    *p++ = ' ';
+    p = format_fixed6(p, node->radius);
+    for(int d = 0; d < n_dims; d++) {
+        *p++ = ' ';
+        p = format_fixed6(p, node->center[d]);
+    }
+    for(long i = 0; i < node->n_points * n_dims; i++) {
+        *p++ = ' ';
+        p = format_fixed6(p, node->points[i]);
+    }
+    *p++ = '\n';
+    buffer->size = p - buffer->text;
+}
+
+void print_node(FILE* out, node_ptr node) {
+    text_buffer_t buffer = { NULL, 0, 0 };
+    format_node(&buffer, node);
+    fwrite(buffer.text, 1, buffer.size, out);
+    free(buffer.text);
+}
+
+/*
+Writes the node lines of the tree. The OpenMP threads format blocks of TEXT_BLOCK lines into their own buffers,
+which are then written in order with one large write each
+*/
+void dump_tree(FILE* out) {
+    long n_buffers = omp_get_max_threads() * TEXT_BLOCKS_PER_THREAD;
+    text_buffer_t* buffers = (text_buffer_t*) calloc(n_buffers, sizeof(text_buffer_t));
+    if(buffers == NULL) {
+        fprintf(stderr, "Error allocating the tree output, exiting.\n");
+        exit(10);
+    }
+
+    for(long first = 0; first < node_counter; first += n_buffers * TEXT_BLOCK) {
+        long n_blocks = MIN(n_buffers, (node_counter - first + TEXT_BLOCK - 1) / TEXT_BLOCK);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(long b = 0; b < n_blocks; b++) {
+            long low = first + b * TEXT_BLOCK;
+            long high = MIN(low + TEXT_BLOCK, node_counter);
+            buffers[b].size = 0;
+            for(long i = low; i < high; i++) {
+                format_node(&buffers[b], &node_list[i]);
+            }
+        }
+
+        for(long b = 0; b < n_blocks; b++) {
+            fwrite(buffers[b].text, 1, buffers[b].size, out);
+        }
+    }
 
-    printf("%ld %ld %ld %.6f", node->id, node->left_id, node->right_id, node->radius);
+    for(long b = 0; b < n_buffers; b++) {
+        free(buffers[b].text);
+    }
+    free(buffers);
+}
 
-    print_point(node->center);
+/*
+Writes the header of a binary tree file with n_nodes nodes
+*/
+void dump_tree_binary_header(FILE* out, long n_nodes) {
+    struct tree_file_header header = {
+        .magic = TREE_FILE_MAGIC,
+        .version = build_options.leaf_size > 1 ? TREE_FILE_BUCKETS_VERSION : TREE_FILE_VERSION,
+        .coord_size = sizeof(coord_t),
+        .n_dims = n_dims,
+        .n_nodes = n_nodes
+    };
+    fwrite(&header, sizeof(header), 1, out);
 }
 
-void dump_tree() {
+/*
+Writes the binary records of the nodes in node_list
+*/
+void dump_tree_binary_nodes(FILE* out) {
+    struct tree_file_node records[DUMP_BLOCK];
+    for (long i = 0; i < node_counter; i += DUMP_BLOCK) {
+        long n_records = node_counter - i < DUMP_BLOCK ? node_counter - i : DUMP_BLOCK;
+        for (long j = 0; j < n_records; j++) {
+            node_ptr node = &node_list[i + j];
+            records[j].id = node->id;
+            records[j].left_id = node->left_id;
+            records[j].right_id = node->right_id;
+            if(node->points != NULL) {
+                records[j].right_id = leaf_points_offset + (node->points - leaf_points[0]) / n_dims;
+            }
+            records[j].radius = node->radius;
+        }
+        fwrite(records, sizeof(struct tree_file_node), n_records, out);
+    }
+}
+
+/*
+Writes the centers of the nodes in node_list, in the order of their records
+*/
+void dump_tree_binary_centers(FILE* out) {
     for (long i = 0; i < node_counter; i++) {
-        print_node(&node_list[i]);
+        fwrite(node_list[i].center, sizeof(coord_t), n_dims, out);
+    }
+}
+
+/*
+Writes the padding between the centers and the points of the leaves of a bucket tree with n_nodes nodes
+*/
+void dump_tree_binary_points_padding(FILE* out, long n_nodes) {
+    static const char padding[8];
+    long centers_end = TREE_FILE_CENTERS_OFFSET(n_nodes) + n_nodes * n_dims * (long) sizeof(coord_t);
+    fwrite(padding, 1, TREE_FILE_POINTS_OFFSET(n_nodes, n_dims, sizeof(coord_t)) - centers_end, out);
+}
+
+/*
+Writes the points of the leaves in leaf_points
+*/
+void dump_tree_binary_points(FILE* out) {
+    if(leaf_point_counter > 0) {
+        fwrite(leaf_points[0], sizeof(coord_t), leaf_point_counter * n_dims, out);
+    }
+}
+
+/*
+Writes the tree as a binary tree file, see tree_format.h
+*/
+void dump_tree_binary(FILE* out, long n_nodes) {
+    dump_tree_binary_header(out, n_nodes);
+    dump_tree_binary_nodes(out);
+    dump_tree_binary_centers(out);
+    if(build_options.leaf_size > 1) {
+        dump_tree_binary_points_padding(out, n_nodes);
+        dump_tree_binary_points(out);
     }
 }
\ No newline at end of file
@@ -1,19 +1,32 @@
 #ifndef BALL_TREE_H
 #define BALL_TREE_H
 
+#include <stdio.h>
+#include "coords.h"
+
 struct tree_node {
     long id;
     double radius;
-    double* center;
-    long left_id;
+    coord_t* center;
+    long left_id; // -1 for leaves, -n_points for the leaves of bucket trees
     long right_id;
+    coord_t* points; // points of a leaf of a bucket tree, one after the other, NULL for other nodes
+    long n_points;
 };
 
 typedef struct tree_node node_t;
 typedef struct tree_node *node_ptr;
 
-node_ptr make_node(long id, double* center, double radius, node_ptr new_node);
-void print_node(node_ptr node);
-void dump_tree();
+node_ptr make_node(long id, coord_t* center, double radius, node_ptr new_node);
+void print_node(FILE* out, node_ptr node);
+void dump_tree(FILE* out);
+
+// Binary output of the tree, see tree_format.h. The parts are separate so processes can write theirs in turn
+void dump_tree_binary_header(FILE* out, long n_nodes);
+void dump_tree_binary_nodes(FILE* out);
+void dump_tree_binary_centers(FILE* out);
+void dump_tree_binary_points_padding(FILE* out, long n_nodes);
+void dump_tree_binary_points(FILE* out);
+void dump_tree_binary(FILE* out, long n_nodes);
 
 #endif
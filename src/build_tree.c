@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <math.h>
+#include <string.h>
+#include "point_operations.h"
+#include "ball_tree.h"
+#include "selection.h"
+#include "parallel_operations.h"
+#include "point_kernels.h"
+#include "soa_points.h"
+#include "macros.h"
+#include "options.h"
+#include "build_tree.h"
+
+#define TASK_CUTOFF 4096 // subtrees with at most this many points are built by the task that reaches them
+#define SOA_CUTOFF 1024 // dimension major subtrees with at most this many points are built from an array of points
+
+extern int n_dims; // number of dimensions of each point
+
+extern node_ptr node_list; // list of nodes of the ball tree
+extern coord_t** node_centers; // list of centers of the ball tree nodes
+
+/*
+Places in nodes and nodes_next the number of nodes of the subtrees of n_points and n_points + 1 points.
+The halves of n_points and n_points + 1 points have m or m + 1 points, so each level takes a single call
+*/
+static void count_tree_nodes_pair(long n_points, long* nodes, long* nodes_next) {
+    long leaf_size = build_options.leaf_size;
+    if(n_points + 1 <= leaf_size) {
+        *nodes = 1;
+        *nodes_next = 1;
+        return;
+    }
+    long m = n_points / 2;
+    long half_nodes[2]; // nodes of the subtrees of m and m + 1 points
+    count_tree_nodes_pair(m, &half_nodes[0], &half_nodes[1]);
+    *nodes = n_points <= leaf_size ? 1 :
+        1 + half_nodes[LEFT_PARTITION_SIZE(n_points) - m] + half_nodes[RIGHT_PARTITION_SIZE(n_points) - m];
+    *nodes_next = 1 + half_nodes[LEFT_PARTITION_SIZE(n_points + 1) - m] + half_nodes[RIGHT_PARTITION_SIZE(n_points + 1) - m];
+}
+
+/*
+Returns the number of nodes of the subtree of n_points points, 2 * n_points - 1 when every leaf holds a single point
+*/
+long count_tree_nodes(long n_points) {
+    if(build_options.leaf_size == 1) {
+        return 2 * n_points - 1;
+    }
+    long nodes, nodes_next;
+    count_tree_nodes_pair(n_points, &nodes, &nodes_next);
+    return nodes;
+}
+
+/*
+Returns a list for n_points pointers to points, exiting if it cannot be allocated.
+Lists sized by the points of a leaf or a subtree are not on the stack, since --leaf-size has no upper bound
+*/
+static coord_t** create_point_list(long n_points) {
+    coord_t** list = (coord_t**) malloc(n_points * sizeof(coord_t*));
+    if(list == NULL) {
+        printf("Error allocating array of points, exiting.\n");
+        exit(4);
+    }
+    return list;
+}
+
+/*
+Orders points lexicographically, for qsort on arrays of points
+*/
+static int compare_points(const void* pt1, const void* pt2) {
+    coord_t* a = *(coord_t**) pt1;
+    coord_t* b = *(coord_t**) pt2;
+    for(int d = 0; d < n_dims; d++) {
+        if(a[d] != b[d]) {
+            return a[d] < b[d] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/*
+Makes the node with id node_id in slot node_index a leaf of the n_points points in pts, which are copied
+to leaf_pts in lexicographic order. The center is the middle of the bounding box of the points.
+Neither depends on the order of the points, so every builder writes the same leaf
+*/
+void make_bucket(coord_t** pts, long n_points, coord_t** leaf_pts, long node_id, long node_index) {
+    coord_t** sorted = create_point_list(n_points);
+    memcpy(sorted, pts, n_points * sizeof(coord_t*));
+    qsort(sorted, n_points, sizeof(coord_t*), compare_points);
+    copy_point_list(sorted, leaf_pts, n_points);
+    free(sorted);
+
+    coord_t* center = node_centers[node_index];
+    coord_t low[n_dims];
+    copy_point(leaf_pts[0], low);
+    copy_point(leaf_pts[0], center);
+    for(long i = 1; i < n_points; i++) {
+        for(int d = 0; d < n_dims; d++) {
+            low[d] = MIN(low[d], leaf_pts[i][d]);
+            center[d] = MAX(center[d], leaf_pts[i][d]);
+        }
+    }
+    middle_point(low, center, center);
+
+    double max_distance;
+    point_kernels.furthest_point(leaf_pts, n_points, center, &max_distance);
+
+    node_ptr node = make_node(node_id, center, sqrt(max_distance), &node_list[node_index]);
+    node->left_id = -n_points;
+    node->points = leaf_pts[0];
+    node->n_points = n_points;
+}
+
+/*
+Returns the rows of leaf_pts from low on, leaf_pts being NULL when the tree has no bucket leaves
+*/
+static coord_t** leaf_pts_from(coord_t** leaf_pts, long low) {
+    return leaf_pts == NULL ? NULL : leaf_pts + low;
+}
+
+/*
+Returns the point in pts furthest away from point p
+*/
+coord_t* get_furthest_away_point(coord_t** pts, long n_points, coord_t* p) {
+    if(USE_PARALLEL_SCANS(n_points)) {
+        return parallel_get_furthest_away_point(pts, n_points, p);
+    }
+    double max_distance;
+    long furthest = point_kernels.furthest_point(pts, n_points, p, &max_distance);
+    return furthest < 0 ? p : pts[furthest];
+}
+
+/*
+Returns the radius of the ball tree node of points pts defined by point center
+*/
+double get_radius(coord_t** pts, long n_points, coord_t* center) {
+    coord_t* a = get_furthest_away_point(pts, n_points, center);
+    return sqrt(distance(a, center));
+}
+
+/*
+Places in center the median projection of the projection parameters ortho_array onto line
+starting in a and defined by basub, by selecting the middle parameters in ortho_array_srt.
+Returns the upper middle parameter, the boundary between the left and right partitions
+*/
+double get_center(double* ortho_array, double* ortho_array_srt, long n_points, coord_t* basub, coord_t* a, coord_t* ortho_tmp, coord_t* center) {
+    double first_middle, second_middle;
+
+    memcpy(ortho_array_srt, ortho_array, sizeof(double) * n_points);
+    select_median_doubles(ortho_array_srt, n_points, &first_middle, &second_middle);
+
+    if(n_points % 2) { // is odd
+        projection_point(basub, a, second_middle, center);
+    }
+    else { // is even
+        projection_point(basub, a, first_middle, ortho_tmp);
+        projection_point(basub, a, second_middle, center);
+        middle_point(ortho_tmp, center, center);
+    }
+    return second_middle;
+}
+
+/*
+Computes into ortho_array the projection parameters of points in pts onto line defined by b-a,
+placing b-a in basub.
+The direction of the line is flipped when needed so that the parameters
+are ordered like the x coordinates of the projections
+*/
+void calc_orthogonal_projections(coord_t** pts, long n_points, coord_t* a, coord_t* b, coord_t* basub, coord_t* ortho_tmp, double* ortho_array) {
+    sub_points(b, a, basub);
+    if(basub[0] < 0) {
+        mul_scalar(basub, -1, basub);
+    }
+    if(USE_PARALLEL_SCANS(n_points)) {
+        parallel_projection_parameters(pts, n_points, basub, a, ortho_array);
+        return;
+    }
+    point_kernels.projection_parameters(pts, n_points, basub, a, ortho_array);
+}
+
+/*
+Places each point in pts in partition left or right by comparing
+its projection parameter with the upper middle parameter split.
+When several points project onto split, the first of them go to left until it has n_points_left points,
+so ties at the median are split in the same way by every builder
+*/
+void fill_partitions(coord_t** pts, long n_points, double* ortho_array, coord_t** left, coord_t** right, double split, long n_points_left) {
+    if(USE_PARALLEL_SCANS(n_points)) {
+        parallel_fill_partitions(pts, n_points, ortho_array, left, right, split, n_points_left);
+        return;
+    }
+    long ties = n_points_left; // points equal to split that go to left
+    for(long i = 0; i < n_points; i++) {
+        ties -= ortho_array[i] < split;
+    }
+    long l = 0;
+    long r = 0;
+    for(long i = 0; i < n_points; i++) {
+        int tie = ortho_array[i] == split && ties > 0;
+        ties -= tie;
+        if(ortho_array[i] < split || tie) {
+            copy_point(pts[i], left[l]);
+            l++;
+        }
+        else {
+            copy_point(pts[i], right[r]);
+            r++;
+        }
+    }
+}
+
+/*
+Builds the subtree with id node_id of the n_points points in pts.
+Nodes are placed in preorder, so the subtree takes the count_tree_nodes(n_points) slots of node_list
+starting at node_index and the slots of both children are known before either is built.
+With --leaf-size above 1, subtrees of at most that many points are leaves whose points go to leaf_pts.
+Each subtree only touches its own slices of the buffers, so large ones are built as OpenMP tasks.
+The points are partitioned into pts_aux and the children use the rows of pts_next as theirs, which are those of pts
+except for the points of build_tree_read_only
+*/
+static void build_node(coord_t** pts, coord_t** pts_aux, coord_t** pts_next, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points, long node_id, long node_index) {
+    if(n_points <= build_options.leaf_size && build_options.leaf_size > 1) {
+        make_bucket(pts, n_points, leaf_pts, node_id, node_index);
+        return;
+    }
+    if(n_points == 1) {
+        copy_point(pts[0], node_centers[node_index]);
+        make_node(node_id, node_centers[node_index], 0, &node_list[node_index]);
+        return;
+    }
+
+    coord_t basub[n_dims]; // b-a for the orthogonal projections
+    coord_t ortho_tmp[n_dims]; // temporary point used for calculating the orthogonal projections
+
+    coord_t* a = get_furthest_away_point(pts, n_points, pts[0]);
+    coord_t* b = get_furthest_away_point(pts, n_points, a);
+
+    calc_orthogonal_projections(pts, n_points, a, b, basub, ortho_tmp, ortho_array);
+
+    coord_t* center = node_centers[node_index];
+    double split = get_center(ortho_array, ortho_array_srt, n_points, basub, a, ortho_tmp, center);
+    double radius = get_radius(pts, n_points, center);
+
+    node_ptr node = make_node(node_id, center, radius, &node_list[node_index]);
+
+    long n_points_left = LEFT_PARTITION_SIZE(n_points);
+    long n_points_right = RIGHT_PARTITION_SIZE(n_points);
+
+    coord_t **left = pts_aux;
+    coord_t **right = pts_aux + n_points_left;
+
+    long node_id_left = 2 * node_id + 1;
+    long node_id_right = 2 * node_id + 2;
+
+    long node_index_left = node_index + 1;
+    long node_index_right = node_index + 1 + count_tree_nodes(n_points_left);
+
+    node->left_id = node_id_left;
+    node->right_id = node_id_right;
+
+    fill_partitions(pts, n_points, ortho_array, left, right, split, n_points_left);
+
+    #pragma omp task if(n_points_left > TASK_CUTOFF)
+    build_tree(left, pts_next, ortho_array, ortho_array_srt, leaf_pts, n_points_left, node_id_left, node_index_left);
+
+    build_tree(right, pts_next + n_points_left, ortho_array + n_points_left, ortho_array_srt + n_points_left, leaf_pts_from(leaf_pts, n_points_left), n_points_right, node_id_right, node_index_right);
+}
+
+void build_tree(coord_t** pts, coord_t** pts_aux, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points, long node_id, long node_index) {
+    build_node(pts, pts_aux, pts, ortho_array, ortho_array_srt, leaf_pts, n_points, node_id, node_index);
+}
+
+/*
+Builds the tree like build_tree without writing to the rows of pts, which may be a read-only mapping of the points.
+Only the root reads them, its children use the rows of pts_next instead
+*/
+void build_tree_read_only(coord_t** pts, coord_t** pts_aux, coord_t** pts_next, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points) {
+    build_node(pts, pts_aux, pts_next, ortho_array, ortho_array_srt, leaf_pts, n_points, 0, 0);
+}
+
+/*
+Places in out the point in pts furthest away from point p, or p itself if all points are at distance 0
+*/
+static void soa_get_furthest_away_point(soa_t pts, long n_points, coord_t* p, coord_t* out) {
+    double max_distance;
+    long furthest = soa_furthest_point(pts, n_points, p, &max_distance);
+    if(furthest < 0) {
+        copy_point(p, out);
+        return;
+    }
+    soa_get_point(pts, furthest, out);
+}
+
+/*
+Builds a small subtree of points stored dimension major with build_tree, where the scans of a node
+are too short for the dimension major layout to pay off.
+The points are copied as an array of points to the region of the subtree in pts_aux,
+and the region in pts is then free to be the auxiliary array of points
+*/
+static void build_tree_soa_small(soa_t pts, soa_t pts_aux, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points, long node_id, long node_index) {
+    coord_t** array_pts = create_point_list(n_points);
+    coord_t** array_pts_aux = create_point_list(n_points);
+    for(long i = 0; i < n_points; i++) {
+        array_pts[i] = pts_aux.data + i * n_dims;
+        array_pts_aux[i] = pts.data + i * n_dims;
+    }
+    soa_to_array_pts(pts, n_points, array_pts);
+    #pragma omp taskgroup
+    build_tree(array_pts, array_pts_aux, ortho_array, ortho_array_srt, leaf_pts, n_points, node_id, node_index);
+    free(array_pts);
+    free(array_pts_aux);
+}
+
+/*
+Same as build_tree for points stored dimension major.
+The computations are the ones of build_tree in the same order, so the tree is identical
+*/
+void build_tree_soa(soa_t pts, soa_t pts_aux, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points, long node_id, long node_index) {
+    if(n_points <= SOA_CUTOFF || n_points <= build_options.leaf_size) {
+        build_tree_soa_small(pts, pts_aux, ortho_array, ortho_array_srt, leaf_pts, n_points, node_id, node_index);
+        return;
+    }
+
+    coord_t basub[n_dims]; // b-a for the orthogonal projections
+    coord_t ortho_tmp[n_dims]; // temporary point used for calculating the orthogonal projections
+    coord_t a[n_dims]; // furthest point from the first point
+    coord_t b[n_dims]; // furthest point from a
+
+    soa_get_point(pts, 0, b);
+    soa_get_furthest_away_point(pts, n_points, b, a);
+    soa_get_furthest_away_point(pts, n_points, a, b);
+
+    sub_points(b, a, basub);
+    if(basub[0] < 0) {
+        mul_scalar(basub, -1, basub);
+    }
+    soa_projection_parameters(pts, n_points, basub, a, ortho_array);
+
+    coord_t* center = node_centers[node_index];
+    double split = get_center(ortho_array, ortho_array_srt, n_points, basub, a, ortho_tmp, center);
+    double max_distance;
+    soa_furthest_point(pts, n_points, center, &max_distance);
+    double radius = sqrt(max_distance);
+
+    node_ptr node = make_node(node_id, center, radius, &node_list[node_index]);
+
+    long n_points_left = LEFT_PARTITION_SIZE(n_points);
+    long n_points_right = RIGHT_PARTITION_SIZE(n_points);
+
+    soa_t left = soa_partition(pts_aux, 0, n_points_left);
+    soa_t right = soa_partition(pts_aux, n_points_left, n_points_right);
+
+    long node_id_left = 2 * node_id + 1;
+    long node_id_right = 2 * node_id + 2;
+
+    long node_index_left = node_index + 1;
+    long node_index_right = node_index + 1 + count_tree_nodes(n_points_left);
+
+    node->left_id = node_id_left;
+    node->right_id = node_id_right;
+
+    soa_fill_partitions(pts, n_points, ortho_array, left, right, split, n_points_left);
+
+    #pragma omp task if(n_points_left > TASK_CUTOFF)
+    build_tree_soa(left, soa_partition(pts, 0, n_points_left), ortho_array, ortho_array_srt, leaf_pts, n_points_left, node_id_left, node_index_left);
+
+    build_tree_soa(right, soa_partition(pts, n_points_left, n_points_right), ortho_array + n_points_left, ortho_array_srt + n_points_left, leaf_pts_from(leaf_pts, n_points_left), n_points_right, node_id_right, node_index_right);
+}
+
+/*
+Builds the subtree of the points in pts like build_tree, after copying them to a dimension major layout.
+The copies are freed once the subtree is built
+*/
+void build_tree_from_soa(coord_t** pts, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points, long node_id, long node_index) {
+    soa_t soa_pts = create_soa_points(n_dims, n_points);
+    soa_t soa_pts_aux = create_soa_points(n_dims, n_points);
+    soa_from_array_pts(pts, n_points, soa_pts);
+
+    #pragma omp taskgroup
+    build_tree_soa(soa_pts, soa_pts_aux, ortho_array, ortho_array_srt, leaf_pts, n_points, node_id, node_index);
+
+    free_soa_points(soa_pts);
+    free_soa_points(soa_pts_aux);
+}
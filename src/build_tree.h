@@ -0,0 +1,50 @@
+#ifndef BUILD_TREE_H
+#define BUILD_TREE_H
+
+#include "soa_points.h"
+
+/*
+Shared memory ball tree construction, used by ballAlg and by the processes of ballAlg-mpi
+once their team has a single process.
+Scans of nodes with many points are split among the OpenMP threads and large subtrees are built
+as OpenMP tasks, so these must run inside a parallel region (e.g. from a single or master construct).
+Centers are written to node_centers and nodes to node_list.
+With --leaf-size above 1 the subtrees of at most that many points are bucket leaves, whose points are copied to the
+rows of leaf_pts of the subtree (a subtree of n points starting at point i of the tree takes rows i to i + n - 1).
+leaf_pts is NULL for trees with a leaf per point.
+*/
+
+//Returns the number of nodes of the subtree of n_points points
+long count_tree_nodes(long n_points);
+
+//Makes the node in slot node_index a leaf of the n_points points in pts, copied to leaf_pts
+void make_bucket(coord_t** pts, long n_points, coord_t** leaf_pts, long node_id, long node_index);
+
+//Returns the point in pts furthest away from point p
+coord_t* get_furthest_away_point(coord_t** pts, long n_points, coord_t* p);
+
+//Returns the radius of the ball tree node of points pts defined by point center
+double get_radius(coord_t** pts, long n_points, coord_t* center);
+
+//Places in center the median projection and returns the upper middle projection parameter
+double get_center(double* ortho_array, double* ortho_array_srt, long n_points, coord_t* basub, coord_t* a, coord_t* ortho_tmp, coord_t* center);
+
+//Computes into ortho_array the projection parameters of points in pts onto line defined by b-a
+void calc_orthogonal_projections(coord_t** pts, long n_points, coord_t* a, coord_t* b, coord_t* basub, coord_t* ortho_tmp, double* ortho_array);
+
+//Places each point in pts in partition left or right by comparing its projection parameter with split, ties going to left until it has n_points_left points
+void fill_partitions(coord_t** pts, long n_points, double* ortho_array, coord_t** left, coord_t** right, double split, long n_points_left);
+
+//Builds the subtree with id node_id of the points in pts into the count_tree_nodes(n_points) node slots starting at node_index
+void build_tree(coord_t** pts, coord_t** pts_aux, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points, long node_id, long node_index);
+
+//Builds the tree of the points in pts like build_tree without writing to their rows, the children of the root using those of pts_next
+void build_tree_read_only(coord_t** pts, coord_t** pts_aux, coord_t** pts_next, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points);
+
+//Same as build_tree for points stored dimension major, pts_aux holding room for as many points as pts
+void build_tree_soa(soa_t pts, soa_t pts_aux, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points, long node_id, long node_index);
+
+//Builds the subtree of the points in pts like build_tree, over a dimension major copy of the points
+void build_tree_from_soa(coord_t** pts, double* ortho_array, double* ortho_array_srt, coord_t** leaf_pts, long n_points, long node_id, long node_index);
+
+#endif
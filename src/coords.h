@@ -0,0 +1,20 @@
+#ifndef COORDS_H
+#define COORDS_H
+
+/*
+Type of the point coordinates, of the node centers and of the points sent between processes.
+Building with -DFLOAT_COORDS (make PRECISION=float) stores them in single precision, halving the memory
+taken by the points and the volume of the point transfers of ballAlg-mpi.
+Distances and projection parameters are accumulated in double in both modes, so the median selection
+and the furthest point ties compare values of the same precision.
+*/
+
+#ifdef FLOAT_COORDS
+typedef float coord_t;
+#define MPI_COORD MPI_FLOAT
+#else
+typedef double coord_t;
+#define MPI_COORD MPI_DOUBLE
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "fixed_format.h"
+
+#define FIXED_SCALE 1000000 // 10 to the number of decimals
+#define FIXED_LIMIT 9e12 // magnitude below which the scaled value fits in 63 bits, larger ones go through snprintf
+#define MIN_FIXED_EXPONENT (-100) // binary exponents below which the scaled value rounds to 0
+
+/*
+Writes the decimal digits of value and returns the end of the text
+*/
+static char* format_digits(char* out, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while(value > 0);
+    while(n > 0) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+char* format_long(char* out, long value) {
+    if(value < 0) {
+        *out++ = '-';
+        return format_digits(out, -(uint64_t) value);
+    }
+    return format_digits(out, value);
+}
+
+/*
+The value is m * 2^e exactly, with m the 53 bit mantissa, so value * 10^6 = m * 10^6 * 2^e is rounded to an integer
+with 128 bit integer arithmetic: a shift and a look at the bits shifted out, which is exact, ties going to even
+like glibc. Infinities, NaNs and values too large for the integer part to fit in 64 bits are left to snprintf
+*/
+char* format_fixed6(char* out, double value) {
+    if(!isfinite(value) || fabs(value) >= FIXED_LIMIT) {
+        return out + snprintf(out, MAX_NUMBER_TEXT + 1, "%.6f", value);
+    }
+    if(signbit(value)) {
+        *out++ = '-';
+    }
+
+    int exponent;
+    double fraction = frexp(fabs(value), &exponent);
+    uint64_t mantissa = (uint64_t) ldexp(fraction, 53);
+    unsigned __int128 scaled = (unsigned __int128) mantissa * FIXED_SCALE;
+    uint64_t rounded;
+    exponent -= 53;
+    if(exponent >= 0) {
+        rounded = scaled << exponent;
+    }
+    else if(exponent < MIN_FIXED_EXPONENT) {
+        rounded = 0; // scaled is below 2^74, so the scaled value is below 2^-26
+    }
+    else {
+        int shift = -exponent;
+        unsigned __int128 half = (unsigned __int128) 1 << (shift - 1);
+        unsigned __int128 remainder = scaled & ((half << 1) - 1);
+        rounded = scaled >> shift;
+        if(remainder > half || (remainder == half && (rounded & 1))) {
+            rounded++;
+        }
+    }
+
+    out = format_digits(out, rounded / FIXED_SCALE);
+    *out++ = '.';
+    uint64_t decimals = rounded % FIXED_SCALE;
+    for(int d = 5; d >= 0; d--) {
+        out[d] = '0' + decimals % 10;
+        decimals /= 10;
+    }
+    return out + 6;
+}
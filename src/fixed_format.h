@@ -0,0 +1,20 @@
+#ifndef FIXED_FORMAT_H
+#define FIXED_FORMAT_H
+
+/*
+Conversion of numbers to text for the tree files, without going through printf.
+format_fixed6 writes exactly the digits printf("%.6f") writes (rounding to nearest, ties to even, in the
+default rounding mode), so the files are the same as before.
+The text is not null terminated: each function returns the end of what it wrote.
+*/
+
+// Most characters written by format_fixed6 or format_long
+#define MAX_NUMBER_TEXT 320
+
+//Writes value as printf("%.6f") does and returns the end of the text
+char* format_fixed6(char* out, double value);
+
+//Writes value as printf("%ld") does and returns the end of the text
+char* format_long(char* out, long value);
+
+#endif
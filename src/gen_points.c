@@ -1,18 +1,30 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "coords.h"
 #include "gen_points.h"
+#include "points_file.h"
+#include "random_stream.h"
 
 #define RANGE 10
 
-extern void print_point(double *, int);
+#define GENERATE_CHUNK (1L << 20) // values generated at a time by write_points
 
-double **create_array_pts(int n_dims, long np)
+static char *points_file = NULL; // memory map of the points file the points were loaded from, NULL if they were generated
+static size_t points_file_size;
+
+extern void print_point(coord_t *, int);
+
+coord_t **create_array_pts(int n_dims, long np)
 {
-    double *_p_arr;
-    double **p_arr;
+    coord_t *_p_arr;
+    coord_t **p_arr;
 
-    _p_arr = (double *) malloc(n_dims * np * sizeof(double));
-    p_arr = (double **) malloc(np * sizeof(double *));
+    _p_arr = (coord_t *) malloc(n_dims * np * sizeof(coord_t));
+    p_arr = (coord_t **) malloc(np * sizeof(coord_t *));
     if((_p_arr == NULL) || (p_arr == NULL)){
         printf("Error allocating array of points, exiting.\n");
         exit(4);
@@ -25,13 +37,11 @@ double **create_array_pts(int n_dims, long np)
 }
 
 
-double **get_points(int argc, char *argv[], int *n_dims, long *np)
+/*
+Reads <n_dims> <n_points> <seed> from the arguments, exiting if they are not valid, and returns the seed
+*/
+static unsigned parse_arguments(int argc, char *argv[], int *n_dims, long *np)
 {
-    double **pt_arr;
-    unsigned seed;
-    long i;
-    int j;
-
     if(argc != 4){
         printf("Usage: %s <n_dims> <n_points> <seed>\n", argv[0]);
         exit(1);
@@ -49,19 +59,127 @@ double **get_points(int argc, char *argv[], int *n_dims, long *np)
         exit(3);
     }
 
-    seed = atoi(argv[3]);
-    srandom(seed);
+    return atoi(argv[3]);
+}
 
-    pt_arr = (double **) create_array_pts(*n_dims, *np);
+coord_t **get_points(int argc, char *argv[], int *n_dims, long *np)
+{
+    coord_t **pt_arr;
+    unsigned seed;
+
+    seed = parse_arguments(argc, argv, n_dims, np);
+
+    pt_arr = (coord_t **) create_array_pts(*n_dims, *np);
 
-    for(i = 0; i < *np; i++)
-        for(j = 0; j < *n_dims; j++)
-            pt_arr[i][j] = RANGE * ((double) random()) / RAND_MAX;
+    random_fill(pt_arr[0], *n_dims * *np, seed, 0, RANGE); //same values as srandom(seed) and random()
 
 #ifdef DEBUG
-    for(i = 0; i < *np; i++)
+    for(long i = 0; i < *np; i++)
         print_point(pt_arr[i], *n_dims);
 #endif
 
     return pt_arr;
 }
+
+/*
+Writes the points get_points would generate to file, one after the other, GENERATE_CHUNK values at a time,
+instead of keeping them in memory
+*/
+void write_points(int argc, char *argv[], FILE *file, int *n_dims, long *np)
+{
+    unsigned seed = parse_arguments(argc, argv, n_dims, np);
+    long n_values = *n_dims * *np;
+    coord_t *values = (coord_t *) malloc(GENERATE_CHUNK * sizeof(coord_t));
+    if(values == NULL){
+        printf("Error allocating array of points, exiting.\n");
+        exit(4);
+    }
+
+    for(long first = 0; first < n_values; first += GENERATE_CHUNK){
+        long n = n_values - first < GENERATE_CHUNK ? n_values - first : GENERATE_CHUNK;
+        random_fill(values, n, seed, first, RANGE);
+        if(fwrite(values, sizeof(coord_t), n, file) != (size_t) n){
+            printf("Cannot write the generated points, exiting.\n");
+            exit(4);
+        }
+    }
+    free(values);
+}
+
+/*
+Maps the points file at path (see points_format.h) into memory and returns a list of pointers to its points,
+without copying them when their coordinates have the size of coord_t. The mapping is read-only (see points_mapped),
+so its pages stay those of the page cache and are never copied
+*/
+coord_t **load_points(int argc, char *argv[], char *path, int *n_dims, long *np)
+{
+    struct stat file_stat;
+    coord_t **pt_arr;
+    coord_t *coords;
+    int fd;
+
+    if(argc != 1){
+        printf("Usage: %s --input <points-file>, without <n_dims> <n_points> <seed>\n", argv[0]);
+        exit(1);
+    }
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &file_stat) < 0){
+        printf("Cannot open points file '%s'.\n", path);
+        exit(2);
+    }
+    points_file_size = file_stat.st_size;
+    if(points_file_size < sizeof(struct points_file_header)){
+        printf("Invalid points file '%s'.\n", path);
+        exit(6);
+    }
+    points_file = mmap(NULL, points_file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(points_file == MAP_FAILED){
+        printf("Cannot map points file '%s'.\n", path);
+        exit(2);
+    }
+
+    struct points_file_header *header = (struct points_file_header *) points_file;
+    *np = check_points_file(header, points_file_size, path);
+    *n_dims = header->n_dims;
+    coords = (coord_t *) (points_file + sizeof(*header));
+
+    if(header->coord_size != sizeof(coord_t)){
+        pt_arr = create_array_pts(*n_dims, *np);
+        convert_coords(pt_arr[0], coords, *n_dims * *np, header->coord_size);
+        munmap(points_file, points_file_size);
+        points_file = NULL;
+        return pt_arr;
+    }
+
+    madvise(points_file, points_file_size, MADV_WILLNEED);
+    pt_arr = (coord_t **) malloc(*np * sizeof(coord_t *));
+    if(pt_arr == NULL){
+        printf("Error allocating array of points, exiting.\n");
+        exit(4);
+    }
+    for(long i = 0; i < *np; i++)
+        pt_arr[i] = &coords[i * *n_dims];
+
+    return pt_arr;
+}
+
+/*
+Returns whether the points returned by load_points are in the read-only mapping of the points file
+*/
+int points_mapped()
+{
+    return points_file != NULL;
+}
+
+void free_points(coord_t **pt_arr)
+{
+    if(points_file != NULL){
+        munmap(points_file, points_file_size);
+        points_file = NULL;
+    }
+    else
+        free(pt_arr[0]);
+    free(pt_arr);
+}
@@ -1,8 +1,22 @@
 #ifndef GEN_POINTS_H
 #define GEN_POINTS_H
 
-double **create_array_pts(int n_dims, long np);
+#include <stdio.h>
+#include "coords.h"
 
-double **get_points(int argc, char *argv[], int *n_dims, long *np);
+coord_t **create_array_pts(int n_dims, long np);
+
+coord_t **get_points(int argc, char *argv[], int *n_dims, long *np);
+
+//Writes the points get_points generates to file instead of returning them
+void write_points(int argc, char *argv[], FILE *file, int *n_dims, long *np);
+
+coord_t **load_points(int argc, char *argv[], char *path, int *n_dims, long *np);
+
+//Returns whether the points returned by load_points are in a read-only mapping, which must not be written
+int points_mapped();
+
+//Frees the points returned by get_points or load_points, before their list is reordered
+void free_points(coord_t **pt_arr);
 
 #endif
\ No newline at end of file
@@ -1,24 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <mpi.h>
+#include "coords.h"
 #include "gen_points_mpi.h"
 #include "macros.h"
+#include "points_file.h"
+#include "random_stream.h"
 
 #define RANGE 10
 
 extern int n_procs;
 extern int rank;
 
-extern void print_point(double *, int);
+extern void print_point(coord_t *, int);
 
-double **create_array_pts(int n_dims, long np)
+coord_t **create_array_pts(int n_dims, long np)
 {
-    double *_p_arr;
-    double **p_arr;
+    coord_t *_p_arr;
+    coord_t **p_arr;
 
-    _p_arr = (double *) malloc(n_dims * np * sizeof(double));
-    p_arr = (double **) malloc(np * sizeof(double *));
+    _p_arr = (coord_t *) malloc(n_dims * np * sizeof(coord_t));
+    p_arr = (coord_t **) malloc(np * sizeof(coord_t *));
     if((_p_arr == NULL) || (p_arr == NULL)){
         printf("Error allocating array of points, exiting.\n");
         exit(4);
@@ -30,12 +34,10 @@ double **create_array_pts(int n_dims, long np)
     return p_arr;
 }
 
-double **get_points(int argc, char *argv[], int *n_dims, long *np)
+coord_t **get_points(int argc, char *argv[], int *n_dims, long *np)
 {
-    double **pt_arr;
+    coord_t **pt_arr;
     unsigned seed;
-    long i;
-    int j;
 
     if(argc != 4){
         printf("Usage: %s <n_dims> <n_points> <seed>\n", argv[0]);
@@ -55,7 +57,6 @@ double **get_points(int argc, char *argv[], int *n_dims, long *np)
     }
 
     seed = atoi(argv[3]);
-    srandom(seed);
 
     long np_local = BLOCK_SIZE(rank, n_procs, *np);
     long low = BLOCK_LOW(rank, n_procs, *np);
@@ -63,17 +64,74 @@ double **get_points(int argc, char *argv[], int *n_dims, long *np)
     long min_split = pow(2, floor(log2(n_procs)));
     long point_buffer_size = (long) (ceil((double) (*np) / (double) (min_split)));
 
-    pt_arr = (double **) create_array_pts(*n_dims, point_buffer_size); //Overfit just in case
+    pt_arr = (coord_t **) create_array_pts(*n_dims, point_buffer_size); //Overfit just in case
 
-    for(i = 0; i < low; i++) {
-        for(j = 0; j < *n_dims; j++) {
-            random(); //advance random generator
+    //the values of the points before low are skipped in O(log low) rather than drawn
+    random_fill(pt_arr[0], *n_dims * np_local, seed, *n_dims * low, RANGE);
+
+    return pt_arr;
+}
+
+/*
+Reads the points of this process from the points file at path (see points_format.h): the same BLOCK_LOW and BLOCK_SIZE
+slice get_points generates, read by all the processes at once with collective MPI-IO reads
+*/
+coord_t **load_points(int argc, char *argv[], char *path, int *n_dims, long *np)
+{
+    struct points_file_header header;
+    coord_t **pt_arr;
+    MPI_File file;
+    MPI_Offset file_size;
+
+    if(argc != 1){
+        printf("Usage: %s --input <points-file>, without <n_dims> <n_points> <seed>\n", argv[0]);
+        exit(1);
+    }
+
+    if(MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS){
+        printf("Cannot open points file '%s'.\n", path);
+        exit(2);
+    }
+    MPI_File_get_size(file, &file_size);
+    memset(&header, 0, sizeof(header));
+    MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+
+    *np = check_points_file(&header, file_size, path);
+    *n_dims = header.n_dims;
+
+    long np_local = BLOCK_SIZE(rank, n_procs, *np);
+    long low = BLOCK_LOW(rank, n_procs, *np);
+
+    long min_split = pow(2, floor(log2(n_procs)));
+    long point_buffer_size = (long) (ceil((double) (*np) / (double) (min_split)));
+
+    pt_arr = (coord_t **) create_array_pts(*n_dims, point_buffer_size); //Overfit just in case
+
+    long point_size = *n_dims * header.coord_size;
+    long size = np_local * point_size;
+    char *buffer = (char *) pt_arr[0];
+    if(header.coord_size != sizeof(coord_t)){
+        buffer = (char *) malloc(size);
+        if(buffer == NULL){
+            printf("Error allocating array of points, exiting.\n");
+            exit(4);
         }
     }
 
-    for(i = 0; i < np_local; i++)
-        for(j = 0; j < *n_dims; j++)
-            pt_arr[i][j] = RANGE * ((double) random()) / RAND_MAX;
+    //the reads are collective, so every process takes part in the rounds of the largest slice
+    long max_size = (*np + n_procs - 1) / n_procs * point_size;
+    long n_rounds = (max_size + INPUT_CHUNK - 1) / INPUT_CHUNK;
+    for(long round = 0; round < n_rounds; round++){
+        long read = MIN(round * INPUT_CHUNK, size);
+        MPI_File_read_at_all(file, sizeof(header) + low * point_size + read, buffer + read,
+                             MIN(size - read, INPUT_CHUNK), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&file);
+
+    if(header.coord_size != sizeof(coord_t)){
+        convert_coords(pt_arr[0], buffer, np_local * *n_dims, header.coord_size);
+        free(buffer);
+    }
 
     return pt_arr;
 }
@@ -1,12 +1,16 @@
 #ifndef GEN_POINTS_MPI_H
 #define GEN_POINTS_MPI_H
 
-double **create_array_pts(int n_dims, long np);
+#include "coords.h"
 
-double **get_points(int argc, char *argv[], int *n_dims, long *np);
+coord_t **create_array_pts(int n_dims, long np);
 
-void free_array_pts(double ** p_arr);
+coord_t **get_points(int argc, char *argv[], int *n_dims, long *np);
 
-long realoc_array_pts(double ** p_arr, int n_dims, long curr_size, long new_size);
+coord_t **load_points(int argc, char *argv[], char *path, int *n_dims, long *np);
+
+void free_array_pts(coord_t ** p_arr);
+
+long realoc_array_pts(coord_t ** p_arr, int n_dims, long curr_size, long new_size);
 
 #endif
\ No newline at end of file
@@ -5,18 +5,18 @@
 #include <float.h>
 #include <mpi.h>
 #include "point_operations.h"
-#include "gen_points.h"
 #include "macros.h"
 #include "point_utils_mpi.h"
+#include "selection.h"
+#include "parallel_operations.h"
 
-extern double **ortho_array;
-extern double **ortho_array_srt;
+#define SELECT_GATHER_THRESHOLD 4096        /* once this few candidates remain globally they are gathered and selected locally  */
+#define PSRS_MAX_SAMPLES_PER_PROCESS 64     /* regular samples taken by each process to choose the psrs pivots                   */
 
-extern double *median_left_point;
-extern double *median_right_point;
+extern double *ortho_array;
+extern double *ortho_array_srt;
 
 extern long n_points_local;
-extern long n_dims;
 extern long n_points_global;
 
 extern long *processes_n_points;
@@ -27,144 +27,121 @@ extern int n_procs;
 extern MPI_Comm communicator;
 
 /*
-Places in recv_counts how many data elements each process will send in the naive_get_center implementation.
+Places in recv_counts how many projection parameters each process will send in the naive_get_center implementation.
 Places in displays the displacement of the data received by each process in the naive_get_center implementation.
 */
 void naive_compute_receive_info(int *recv_counts, int *displays) {
     int displacement = 0;
     for(int i = 0; i < n_procs; i++) {
-        recv_counts[i] = processes_n_points[i] * n_dims; /* receiving processes_n_points[i] * n_dims doubles from process i */
-        displays[i] = displacement * n_dims; /* data received from process i will start in index display */
+        recv_counts[i] = processes_n_points[i]; /* receiving processes_n_points[i] doubles from process i */
+        displays[i] = displacement; /* data received from process i will start in index display */
         displacement += processes_n_points[i];
     }
 }
 
 /*
-Copies the median projection of sorted_projections to out.
-Assumes sorted_projections contains all global projections sorted.
-Used by the naive_get_center implementation.
-*/
-void naive_copy_median_projection(double **sorted_projections, double *out) {
-    if(n_points_global % 2) {
-        /* is odd */
-        long middle = (n_points_global - 1) / 2;
-        copy_point(sorted_projections[middle] , out);
-    }
-    else {
-        /* is even */
-        long first_middle = (n_points_global / 2) - 1;
-        long second_middle = (n_points_global / 2);
-        middle_point(sorted_projections[first_middle], sorted_projections[second_middle], out);
-    }
-}
-
-/*
-Naive get_center implementation where all processes receive and sort all projections and copy the median to out.
+Naive get_center implementation where all processes receive all projection parameters
+and select the two middle ones, placing them in first and second.
 Used when n_points_global < n_procs^2 and so parallel sorting by regular sampling is not viable.
 */
-void mpi_naive_get_center(double *out) {
+void mpi_naive_get_center(double *first, double *second) {
     int recv_counts[n_procs];
     int displays[n_procs];
 
     naive_compute_receive_info(recv_counts, displays);
 
-    /*
-    create a buffer to receive all the points
-    and a separate buffer to sort all the points so that
-    it is possible to free the memory at the end
-    */
-    double **receive_buffer = create_array_pts(n_dims, n_points_global);
-    double **sorted_projections = (double**) malloc(sizeof(double*) * n_points_global);
-    memcpy(sorted_projections, receive_buffer, sizeof(double*) * n_points_global);
+    double *receive_buffer = (double*) malloc(sizeof(double) * n_points_global);
 
-    /* receive in sort_receive_buffer the orthogonal projections owned by all the processes */
+    /* receive in receive_buffer the projection parameters owned by all the processes */
     MPI_Allgatherv(
-                *ortho_array,           /* address of what is being sent by the current process */
+                ortho_array,            /* address of what is being sent by the current process */
                 recv_counts[rank],      /* how many elements are being sent */
                 MPI_DOUBLE,             /* sending elements of type double */
-                *receive_buffer,        /* address where I am receiving incoming data */
+                receive_buffer,         /* address where I am receiving incoming data */
                 recv_counts,            /* array stating how much data I will receive from each process*/
                 displays,               /* displacement of data received by each process */
                 MPI_DOUBLE,             /* receiving elements of type double */
                 communicator            /* sending and receiving from/to the entire current team */
     );
 
-    /* sort all orthogonal projections */
-    qsort(sorted_projections, n_points_global, sizeof(double*), compare_point);
-
-    naive_copy_median_projection(sorted_projections, out);
+    select_median_doubles(receive_buffer, n_points_global, first, second);
 
     /*free memory */
-    free(sorted_projections);
-    free(*receive_buffer);
     free(receive_buffer);
 }
 
 /*
-Copies the median projection to out.
-The distribution of projections is given by processes_n_points
-Used by the naive_get_center implementation.
+Places in first and second the two middle projection parameters.
+The distribution of the sorted parameters is given by processes_n_points
+Used by the psrs_get_center implementation.
 */
-void mpi_psrs_copy_median_projection(double **sorted_projections, long *processes_n_points, double *out) {
+void mpi_psrs_get_median_projections(double *sorted_projections, long *processes_n_points, double *first, double *second) {
+    long first_middle = (n_points_global - 1) / 2;
+    long second_middle = n_points_global / 2;
+    *first = mpi_get_value(sorted_projections, first_middle, processes_n_points);
     if(n_points_global % 2) {
         /* is odd */
-        long middle = (n_points_global - 1) / 2;
-        mpi_get_point(sorted_projections, middle, processes_n_points, out);
+        *second = *first;
     }
     else {
         /* is even */
-        long first_middle = (n_points_global / 2) - 1;
-        long second_middle = (n_points_global / 2);
-        mpi_get_point(sorted_projections, first_middle, processes_n_points, median_left_point);
-        mpi_get_point(sorted_projections, second_middle, processes_n_points, median_right_point);
-        middle_point(median_left_point, median_right_point, out);
+        *second = mpi_get_value(sorted_projections, second_middle, processes_n_points);
     }
 }
 
 /*
-Calculate n_proc regular samples of the x coordenated of ortho_array_srt and place them in samples.
-Assumes n_points_local >= n_proc
+Returns the number of regular samples each process contributes to the choice of the psrs pivots.
+Capped so that the samples gathered at every process grow linearly, not quadratically, with n_procs
+*/
+long psrs_n_samples() {
+    return MIN(n_procs, PSRS_MAX_SAMPLES_PER_PROCESS);
+}
+
+/*
+Calculate n_samples regular samples of the projection parameters in ortho_array_srt and place them in samples.
+Assumes n_points_local >= n_samples
 */
-void psrs_calc_local_samples(double *local_samples) {
-    long step = n_points_local / n_procs;
+void psrs_calc_local_samples(double *local_samples, long n_samples) {
+    long step = n_points_local / n_samples;
     long j = 0;
-    for(int i = 0; i < n_procs; i++, j += step) {
-        local_samples[i] = ortho_array_srt[j][0];
+    for(int i = 0; i < n_samples; i++, j += step) {
+        local_samples[i] = ortho_array_srt[j];
     }
 }
 
 /*
 Place into global_samples the samples gathered at each process (local_samples)
 */
-void mpi_psrs_gather_global_samples(double *local_samples, double *global_samples) {
+void mpi_psrs_gather_global_samples(double *local_samples, long n_samples, double *global_samples) {
     MPI_Allgather(
                 local_samples,      /* send my local regular samples */
-                n_procs,            /* measured n_proc regular samples */
+                n_samples,          /* measured n_samples regular samples */
                 MPI_DOUBLE,         /* samples of type double */
                 global_samples,     /* receive all regular samples in global_samples */
-                n_procs,            /* receive n_proc samples from each process */
+                n_samples,          /* receive n_samples samples from each process */
                 MPI_DOUBLE,         /* samples of type double */
                 communicator        /* send and receive from the whole team */
     );
 }
 
 /*
-Computes the pivots for the psrs algorithm by taking n_proc local regular samples of the
-x coordinate of the orthogonal projections, gathering all local regular samples
+Computes the pivots for the psrs algorithm by taking n_samples local regular samples of the
+projection parameters, gathering all local regular samples
 and tanking n_proc -1 regular samples of the gathered result
 */
 void mpi_psrs_get_pivots(double *pivots) {
-    double local_samples[n_procs];
-    double* global_samples = (double*)malloc(sizeof(double) * n_procs * n_procs);
+    long n_samples = psrs_n_samples();
+    double local_samples[n_samples];
+    double* global_samples = (double*)malloc(sizeof(double) * n_procs * n_samples);
 
-    psrs_calc_local_samples(local_samples);
-    mpi_psrs_gather_global_samples(local_samples, global_samples);
+    psrs_calc_local_samples(local_samples, n_samples);
+    mpi_psrs_gather_global_samples(local_samples, n_samples, global_samples);
 
-    qsort(global_samples, n_procs*n_procs , sizeof(double), compare_double);
+    qsort(global_samples, n_procs * n_samples, sizeof(double), compare_double);
 
-    long step = n_procs;
+    long step = n_samples;
     long n_pivots = n_procs - 1;
-    for(long i = 0, j = n_procs; i < n_pivots; i++, j += step) {
+    for(long i = 0, j = n_samples; i < n_pivots; i++, j += step) {
         pivots[i] = global_samples[j];
     }
 
@@ -172,11 +149,16 @@ void mpi_psrs_get_pivots(double *pivots) {
 }
 
 /*
-Copies the ortogonal projections present in ortho_array to ortho_array_srt and sorts ortho_array_srt
+Copies the projection parameters present in ortho_array to ortho_array_srt and sorts ortho_array_srt
 */
 void psrs_sort_local_projections() {
-    memcpy(ortho_array_srt, ortho_array, sizeof(double*) * n_points_local);
-    qsort(ortho_array_srt, n_points_local, sizeof(double*), compare_point);
+    memcpy(ortho_array_srt, ortho_array, sizeof(double) * n_points_local);
+    if(USE_PARALLEL_SCANS(n_points_local)) {
+        parallel_sort_doubles(ortho_array_srt, n_points_local);
+    }
+    else {
+        qsort(ortho_array_srt, n_points_local, sizeof(double), compare_double);
+    }
 }
 
 /*
@@ -189,7 +171,7 @@ void psrs_get_send_info(double* pivots, int *send_counts, int *send_displays){
     long j = 0;
     long k = 0;
     for(long i = 0; i < n_points_local && j != n_procs - 1 ;i++){
-        if (ortho_array_srt[i][0] > pivots[j]){
+        if (ortho_array_srt[i] > pivots[j]){
             send_counts[j] = i - k;
             j++;
             k = i;
@@ -199,7 +181,6 @@ void psrs_get_send_info(double* pivots, int *send_counts, int *send_displays){
 
     int count = 0;
     for(int i = 0; i < n_procs; i++){
-        send_counts[i] *= n_dims;
         send_displays[i] = count;
         count += send_counts[i];
     }
@@ -228,51 +209,32 @@ long psrs_get_receive_info(int *send_counts, int *receive_counts, int *receive_d
         count += receive_counts[i];
     }
 
-    return (receive_displays[n_procs - 1] + receive_counts[n_procs - 1]) / n_dims;
+    return receive_displays[n_procs - 1] + receive_counts[n_procs - 1];
 }
 
 /*
-Transfers to each process his partition of the points.
-Process i receives all the points smaller than pivot i from all other processes.
+Transfers to each process his partition of the projection parameters.
+Process i receives all the parameters smaller than pivot i from all other processes.
 Returns a pointer to the received data.
 */
-double** mpi_psrs_exchange_projections(int *send_counts, int *send_displays, int *receive_counts, int *receive_displays, long n_points_receive) {
-    double **send_buffer = create_array_pts(n_dims, n_points_local);
-    double **receive_buffer = create_array_pts(n_dims, n_points_receive);
-
-    copy_point_list(ortho_array_srt, send_buffer, n_points_local);
+double* mpi_psrs_exchange_projections(int *send_counts, int *send_displays, int *receive_counts, int *receive_displays, long n_points_receive) {
+    double *receive_buffer = (double*) malloc(sizeof(double) * MAX(n_points_receive, 1));
 
     MPI_Alltoallv(
-                *send_buffer,       /* starting address of the data to send*/
+                ortho_array_srt,    /* starting address of the data to send*/
                 send_counts,        /* array stating for each process i the number of data elements the current process will send them */
                 send_displays,      /* array stating for each process i the displacement of the data sent to them in send_buffer */
                 MPI_DOUBLE,         /* sending data elements of type double */
-                *receive_buffer,    /* starting address of where incoming data will be received */
+                receive_buffer,     /* starting address of where incoming data will be received */
                 receive_counts,     /* array stating for each process i the number of data elements the current process will receive from them */
                 receive_displays,   /* array stating for each process i the displacement of the data received from them in recv_buffer */
                 MPI_DOUBLE,         /* receiving data elements of type double */
                 communicator        /* sending and receiving to all processes in the current team */
     );
 
-    free(*send_buffer);
-    free(send_buffer);
-
     return receive_buffer;
 }
 
-/*
-Normalizes receive_counts and receive_displays from storing the number of data elements
-to storing the number of points received.
-*/
-void psrs_normalize_receive_info(int *receive_counts, int *receive_displays) {
-    for(int i = 0; i < n_procs; i++) {
-        receive_counts[i] = receive_counts[i] / n_dims;
-
-    }
-    for(int i = 0; i < n_procs; i++) {
-        receive_displays[i] = receive_displays[i] / n_dims;
-    }
-}
 /*
 Place into receive_processes_n_points the number of points received at each process (n_points_receive)
 Asynchronous operation. The algorithm does useful work while it's receiving (namely merging the received points)
@@ -291,40 +253,37 @@ void mpi_async_psrs_gather_n_points_receive(long *receive_processes_n_points ,lo
 }
 
 /*
-Sorts point list points of size n that is split in p sorted partitions whose size and displacement
+Sorts the list of projection parameters of size n that is split in p sorted partitions whose size and displacement
 is given by counts and displays and writes the result in out
 */
-void psrs_merge_sorted_point_list_partitions(double **points, int *receive_counts, int *receive_displays, long n, double **out) {
-    psrs_normalize_receive_info(receive_counts, receive_displays);
+void psrs_merge_sorted_projection_partitions(double *projections, int *receive_counts, int *receive_displays, long n, double *out) {
     int receive_indexes[n_procs];
     memset(receive_indexes, 0, n_procs * sizeof(int));
 
     for(long i = 0; i < n; i++) {
         double min = DBL_MAX;
-        double *point = NULL;
-        int k = 0;
+        int k = -1;
         for(int j = 0; j < n_procs; j++) {
             if (receive_counts[j] == receive_indexes[j]) {
                 continue;
             }
             long l = receive_displays[j] + receive_indexes[j];
-            if (points[l][0] < min) {
-                point = points[l];
-                min = point[0];
+            if (k == -1 || projections[l] < min) {
+                min = projections[l];
                 k = j;
             }
         }
-        out[i] = point;
+        out[i] = min;
         receive_indexes[k]++;
     }
 }
 
 /*
 get_center implementation that uses parallel sorting by regular sampling
-to sort orthogonal projections and copies the median to out.
+to sort the projection parameters and places the two middle ones in first and second.
 Assumes that n_points_global >= n_procs^2.
 */
-void mpi_psrs_get_center(double* out) {
+void mpi_psrs_get_center(double *first, double *second) {
     double pivots[n_procs - 1];
 
     int receive_counts[n_procs];
@@ -344,19 +303,183 @@ void mpi_psrs_get_center(double* out) {
 
     long n_points_receive = psrs_get_receive_info(send_counts, receive_counts, receive_displays);
 
-    double **receive_buffer = mpi_psrs_exchange_projections(send_counts, send_displays, receive_counts, receive_displays, n_points_receive);
+    double *receive_buffer = mpi_psrs_exchange_projections(send_counts, send_displays, receive_counts, receive_displays, n_points_receive);
 
     mpi_async_psrs_gather_n_points_receive(receive_processes_n_points, n_points_receive, &request);
 
     /* sort received projections while gathering receive_processes_n_points asynchronously */
-    double **sorted_projections = (double**) malloc(sizeof(double*) * n_points_receive);
-    psrs_merge_sorted_point_list_partitions(receive_buffer, receive_counts, receive_displays, n_points_receive, sorted_projections);
+    double *sorted_projections = (double*) malloc(sizeof(double) * MAX(n_points_receive, 1));
+    psrs_merge_sorted_projection_partitions(receive_buffer, receive_counts, receive_displays, n_points_receive, sorted_projections);
 
     MPI_Wait(&request, MPI_STATUS_IGNORE);
 
-    mpi_psrs_copy_median_projection(sorted_projections, receive_processes_n_points, out);
+    mpi_psrs_get_median_projections(sorted_projections, receive_processes_n_points, first, second);
 
-    free(*receive_buffer);
     free(receive_buffer);
     free(sorted_projections);
+}
+
+/*
+Returns the pivot for a round of the distributed selection: the median of the local medians
+of the candidates, weighted by the number of candidates each process holds.
+Only two values per process are exchanged.
+*/
+double mpi_select_get_pivot(double *candidates, long n_candidates) {
+    double local_median[2] = {0.0, (double) n_candidates};  /* (value, weight) */
+    double medians[2 * n_procs];
+
+    if (n_candidates) {
+        select_double(candidates, n_candidates, n_candidates / 2);
+        local_median[0] = candidates[n_candidates / 2];
+    }
+
+    MPI_Allgather(
+                local_median,       /* send my local median and its weight */
+                2,                  /* two values */
+                MPI_DOUBLE,         /* of type double */
+                medians,            /* receive the local medians of every process */
+                2,                  /* two values from each process */
+                MPI_DOUBLE,         /* of type double */
+                communicator        /* send and receive from the whole team */
+    );
+
+    /* sort the (value, weight) pairs by value with an insertion sort, there are only n_procs of them */
+    double total_weight = 0.0;
+    for(int i = 0; i < n_procs; i++) {
+        double value = medians[2 * i];
+        double weight = medians[2 * i + 1];
+        int j = i - 1;
+        while(j >= 0 && medians[2 * j] > value) {
+            medians[2 * (j + 1)] = medians[2 * j];
+            medians[2 * (j + 1) + 1] = medians[2 * j + 1];
+            j--;
+        }
+        medians[2 * (j + 1)] = value;
+        medians[2 * (j + 1) + 1] = weight;
+        total_weight += weight;
+    }
+
+    double weight = 0.0;
+    for(int i = 0; i < n_procs; i++) {
+        weight += medians[2 * i + 1];
+        if (medians[2 * i + 1] > 0 && 2 * weight >= total_weight) {
+            return medians[2 * i];
+        }
+    }
+    return medians[2 * (n_procs - 1)];
+}
+
+/*
+Returns the largest (if max) or smallest candidate held by any process.
+Processes with no candidates do not contribute.
+*/
+double mpi_select_reduce_extreme(double *candidates, long n_candidates, int max) {
+    double local = max ? -DBL_MAX : DBL_MAX;
+    double global;
+    for(long i = 0; i < n_candidates; i++) {
+        local = max ? MAX(local, candidates[i]) : MIN(local, candidates[i]);
+    }
+    MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, max ? MPI_MAX : MPI_MIN, communicator);
+    return global;
+}
+
+/*
+Gathers the remaining candidates of all processes and places in first and second
+the values with rank k_first and k_second among them
+*/
+void mpi_select_gather_candidates(double *candidates, long n_candidates, long k_first, long k_second, double *first, double *second) {
+    int local_count = n_candidates;
+    int counts[n_procs];
+    int displays[n_procs];
+
+    MPI_Allgather(&local_count, 1, MPI_INT, counts, 1, MPI_INT, communicator);
+
+    int count = 0;
+    for(int i = 0; i < n_procs; i++) {
+        displays[i] = count;
+        count += counts[i];
+    }
+
+    double *gathered = (double*) malloc(sizeof(double) * count);
+    MPI_Allgatherv(
+                candidates,         /* send my remaining candidates */
+                local_count,        /* how many candidates i hold */
+                MPI_DOUBLE,         /* of type double */
+                gathered,           /* receive the candidates of every process */
+                counts,             /* how many candidates each process holds */
+                displays,           /* displacement of the candidates of each process */
+                MPI_DOUBLE,         /* of type double */
+                communicator        /* send and receive from the whole team */
+    );
+
+    select_double(gathered, count, k_second);
+    *second = gathered[k_second];
+    if (k_first != k_second) {
+        select_double(gathered, k_second, k_first);
+        *first = gathered[k_first];
+    }
+    else {
+        *first = *second;
+    }
+
+    free(gathered);
+}
+
+/*
+get_center implementation that selects the two middle projection parameters without sorting.
+Every round each process partitions its candidate parameters around a common pivot and
+only the sizes of the partitions are reduced, discarding the side that cannot hold the middles.
+Once few candidates remain globally they are gathered and selected locally.
+Places the middle parameters in first and second.
+*/
+void mpi_select_get_center(double *first, double *second) {
+    double *candidates_buffer = (double*) malloc(sizeof(double) * MAX(n_points_local, 1));
+    double *candidates = candidates_buffer;
+    long n_candidates = n_points_local;
+    long n_candidates_global = n_points_global;
+
+    long k_first = (n_points_global - 1) / 2;   /* rank of the lower middle among the candidates */
+    long k_second = n_points_global / 2;        /* rank of the upper middle among the candidates */
+
+    int found = 0;
+
+    memcpy(candidates, ortho_array, sizeof(double) * n_points_local);
+
+    while (n_candidates_global > SELECT_GATHER_THRESHOLD) {
+        double pivot = mpi_select_get_pivot(candidates, n_candidates);
+
+        long local_counts[2];
+        long global_counts[2];
+        partition_doubles(candidates, n_candidates, pivot, &local_counts[0], &local_counts[1]);
+        MPI_Allreduce(local_counts, global_counts, 2, MPI_LONG, MPI_SUM, communicator);
+
+        long n_less = global_counts[0];
+        long n_less_equal = global_counts[0] + global_counts[1];
+
+        if (k_second < n_less) {
+            /* both middles are smaller than the pivot */
+            n_candidates = local_counts[0];
+            n_candidates_global = n_less;
+        }
+        else if (k_first >= n_less_equal) {
+            /* both middles are greater than the pivot */
+            candidates += local_counts[0] + local_counts[1];
+            n_candidates -= local_counts[0] + local_counts[1];
+            n_candidates_global -= n_less_equal;
+            k_first -= n_less_equal;
+            k_second -= n_less_equal;
+        }
+        else {
+            /* at least one middle is the pivot, the other one is either the pivot or its neighbour */
+            *first = k_first >= n_less ? pivot : mpi_select_reduce_extreme(candidates, local_counts[0], 1);
+            *second = k_second < n_less_equal ? pivot : mpi_select_reduce_extreme(candidates + local_counts[0] + local_counts[1], n_candidates - local_counts[0] - local_counts[1], 0);
+            found = 1;
+            break;
+        }
+    }
+
+    if (!found) {
+        mpi_select_gather_candidates(candidates, n_candidates, k_first, k_second, first, second);
+    }
+    free(candidates_buffer);
 }
\ No newline at end of file
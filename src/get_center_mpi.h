@@ -1,8 +1,10 @@
 #ifndef GET_CENTER_MPI_H
 #define GET_CENTER_MPI_H
 
-void mpi_naive_get_center(double *out);
+void mpi_naive_get_center(double *first, double *second);
 
-void mpi_psrs_get_center();
+void mpi_psrs_get_center(double *first, double *second);
+
+void mpi_select_get_center(double *first, double *second);
 
 #endif
\ No newline at end of file
@@ -15,4 +15,6 @@
 #define IS_POWER_OF_TWO(N) ((N) & ((N) - 1)) == 0)
 
 #define MPI_TAG_DUMP_TREE 90
+#define OUTPUT_CHUNK (1L << 30) // most bytes of the tree sent or written by one MPI call, whose counts are int
+#define INPUT_CHUNK (1L << 30) // most bytes of the points read by one MPI call
 #endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "options.h"
+
+struct build_options build_options = {
+    .soa_layout = 0,
+    .binary_format = 0,
+    .leaf_size = 1,
+    .output_path = NULL,
+    .input_path = NULL,
+    .memory_budget = 0,
+    .spill_dir = NULL
+};
+
+/*
+Sets the option with flag name to value
+*/
+static void set_build_option(char* program, char* name, char* value) {
+    if(!strcmp(name, "--layout")) {
+        if(!strcmp(value, "aos")) {
+            build_options.soa_layout = 0;
+        }
+        else if(!strcmp(value, "soa")) {
+            build_options.soa_layout = 1;
+        }
+        else {
+            printf("Illegal layout (%s), must be aos or soa.\n", value);
+            exit(5);
+        }
+        return;
+    }
+    if(!strcmp(name, "--format")) {
+        if(!strcmp(value, "text")) {
+            build_options.binary_format = 0;
+        }
+        else if(!strcmp(value, "binary")) {
+            build_options.binary_format = 1;
+        }
+        else {
+            printf("Illegal format (%s), must be text or binary.\n", value);
+            exit(5);
+        }
+        return;
+    }
+    if(!strcmp(name, "--leaf-size")) {
+        build_options.leaf_size = atol(value);
+        if(build_options.leaf_size < 1) {
+            printf("Illegal leaf size (%s), must be above 0.\n", value);
+            exit(5);
+        }
+        return;
+    }
+    if(!strcmp(name, "--output")) {
+        build_options.output_path = value;
+        return;
+    }
+    if(!strcmp(name, "--input")) {
+        build_options.input_path = value;
+        return;
+    }
+    if(!strcmp(name, "--memory-budget")) {
+        build_options.memory_budget = atol(value) << 20;
+        if(build_options.memory_budget < 0) {
+            printf("Illegal memory budget (%s), must be 0 or above.\n", value);
+            exit(5);
+        }
+        return;
+    }
+    if(!strcmp(name, "--spill-dir")) {
+        build_options.spill_dir = value;
+        return;
+    }
+    printf("Unknown option %s.\nUsage: %s [--layout aos|soa] [--format text|binary] [--leaf-size K] [--output FILE] [--memory-budget MiB] [--spill-dir DIR] (<n_dims> <n_points> <seed> | --input FILE)\n", name, program);
+    exit(5);
+}
+
+/*
+Parses the "--name value" flags in argv and removes them, keeping the positional arguments in order
+*/
+void parse_build_options(int* argc, char** argv) {
+    int n_args = 1;
+    for(int i = 1; i < *argc; i++) {
+        if(strncmp(argv[i], "--", 2)) {
+            argv[n_args++] = argv[i];
+            continue;
+        }
+        if(i + 1 == *argc) {
+            printf("Missing value for option %s.\n", argv[i]);
+            exit(5);
+        }
+        set_build_option(argv[0], argv[i], argv[i + 1]);
+        i++;
+    }
+    *argc = n_args;
+    argv[n_args] = NULL;
+}
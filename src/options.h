@@ -0,0 +1,25 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+/*
+Optional flags of the builders, given as "--name value" before or between the positional arguments.
+They are taken out of argv by parse_build_options so get_points only sees <n_dims> <n_points> <seed>,
+which are left out when the points are read from a file with --input.
+*/
+
+struct build_options {
+    int soa_layout; // build over points stored dimension major (--layout soa) instead of one point after the other (--layout aos)
+    int binary_format; // write the tree as a binary tree file (--format binary) instead of text (--format text)
+    long leaf_size; // most points of a leaf (--leaf-size), 1 for the classic tree with a leaf per point
+    char* output_path; // file the tree is written to (--output), NULL to write it to stdout
+    char* input_path; // points file the points are read from (--input), NULL to generate them from <n_dims> <n_points> <seed>
+    long memory_budget; // bytes the points and nodes of ballAlg may take (--memory-budget, in MiB), 0 to build the whole tree in memory
+    char* spill_dir; // directory of the temporary files of builds with a memory budget (--spill-dir), NULL for $TMPDIR or /tmp
+};
+
+extern struct build_options build_options;
+
+//Parses and removes the optional flags from argv, updating argc. Exits on unknown flags or bad values
+void parse_build_options(int* argc, char** argv);
+
+#endif
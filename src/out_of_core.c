@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include "ball_tree.h"
+#include "build_tree.h"
+#include "gen_points.h"
+#include "point_operations.h"
+#include "point_kernels.h"
+#include "points_file.h"
+#include "selection.h"
+#include "tree_format.h"
+#include "macros.h"
+#include "options.h"
+#include "out_of_core.h"
+
+#define SCAN_CHUNK_BYTES (64L << 20) // most bytes of points read at a time by the scans of out-of-core nodes
+#define SELECT_SAMPLE 65536 // most pivots of each round of the out-of-core median selection
+#define SPILL_BUFFER_BYTES (1L << 20) // stdio buffer of each temporary file being written
+
+typedef struct point_file {
+    FILE* file; // temporary file of the points, NULL for the points file of --input
+    int fd;
+    long offset; // bytes before the first point
+    int coord_size; // bytes of each coordinate
+    long n_points;
+} point_file_t;
+
+extern int n_dims;
+
+extern node_ptr node_list;
+extern coord_t** node_centers;
+extern long node_counter;
+extern coord_t** leaf_points;
+extern long leaf_point_counter;
+extern long leaf_points_offset;
+
+static FILE* tree_out; // output of the tree
+static long n_tree_nodes; // number of nodes of the whole tree
+static long memory_points; // points of the largest subtree built in memory
+static long chunk_points; // points read at a time by the scans
+static long select_capacity; // projection parameters the median selection may hold at once
+static coord_t** chunk; // points read by the scans
+static double* chunk_values; // projection parameters read by the scans
+
+/*
+Returns the bytes build_tree takes per point: the points and their copy, the projection parameters, about two nodes
+with their centers and the copy of the points in the leaves of bucket trees
+*/
+static long in_memory_point_size() {
+    long point = n_dims * sizeof(coord_t) + sizeof(coord_t*);
+    long leaf = build_options.leaf_size > 1 ? point : 0;
+    return 2 * point + 2 * sizeof(double) + 2 * (sizeof(node_t) + point) + leaf;
+}
+
+/*
+Creates a temporary file in the spill directory, removed once it is closed
+*/
+static FILE* create_spill_file() {
+    char* dir = build_options.spill_dir != NULL ? build_options.spill_dir : getenv("TMPDIR");
+    char path[strlen(dir != NULL ? dir : "/tmp") + 32];
+    sprintf(path, "%s/ballAlg-XXXXXX", dir != NULL ? dir : "/tmp");
+    int fd = mkstemp(path);
+    FILE* file = fd < 0 ? NULL : fdopen(fd, "w+b");
+    if(file == NULL) {
+        fprintf(stderr, "Cannot create a temporary file in '%s', exiting.\n", dir != NULL ? dir : "/tmp");
+        exit(11);
+    }
+    unlink(path);
+    setvbuf(file, NULL, _IOFBF, SPILL_BUFFER_BYTES);
+    return file;
+}
+
+/*
+Makes the points written to the temporary file readable as a point file of n_points points
+*/
+static point_file_t spilled_points(FILE* file, long n_points) {
+    fflush(file);
+    point_file_t points = { file, fileno(file), 0, sizeof(coord_t), n_points };
+    return points;
+}
+
+static void close_point_file(point_file_t* points) {
+    if(points->file != NULL) {
+        fclose(points->file);
+    }
+    else {
+        close(points->fd);
+    }
+}
+
+/*
+Reads size bytes at offset of the file fd into buffer
+*/
+static void read_bytes(int fd, long offset, void* buffer, long size) {
+    for(long done = 0; done < size; ) {
+        ssize_t n = pread(fd, (char*) buffer + done, size - done, offset + done);
+        if(n <= 0) {
+            fprintf(stderr, "Cannot read the points, exiting.\n");
+            exit(11);
+        }
+        done += n;
+    }
+}
+
+static void write_values(FILE* file, void* values, long size, long n) {
+    if(fwrite(values, size, n, file) != (size_t) n) {
+        fprintf(stderr, "Cannot write a temporary file, exiting.\n");
+        exit(11);
+    }
+}
+
+/*
+Reads n points from point first of points into the consecutive rows of pts
+*/
+static void read_points(point_file_t* points, long first, long n, coord_t** pts) {
+    long size = n * n_dims * points->coord_size;
+    long offset = points->offset + first * n_dims * points->coord_size;
+    if(points->coord_size == sizeof(coord_t)) {
+        read_bytes(points->fd, offset, pts[0], size);
+        return;
+    }
+    void* values = malloc(size);
+    if(values == NULL) {
+        fprintf(stderr, "Error allocating the points, exiting.\n");
+        exit(4);
+    }
+    read_bytes(points->fd, offset, values, size);
+    convert_coords(pts[0], values, n * n_dims, points->coord_size);
+    free(values);
+}
+
+/*
+Places in out the point furthest away from p, the first one on ties, or p itself if all points are at distance 0
+*/
+static void furthest_point(point_file_t* points, coord_t* p, coord_t* out) {
+    double max_distance = 0;
+    copy_point(p, out);
+    for(long first = 0; first < points->n_points; first += chunk_points) {
+        long n = MIN(chunk_points, points->n_points - first);
+        read_points(points, first, n, chunk);
+        coord_t* furthest = get_furthest_away_point(chunk, n, p);
+        double d = distance(furthest, p);
+        if(d > max_distance) {
+            max_distance = d;
+            copy_point(furthest, out);
+        }
+    }
+}
+
+/*
+Writes to file the projection parameters of the points onto line defined by b-a, placing b-a in basub
+*/
+static void project_points(point_file_t* points, coord_t* a, coord_t* b, coord_t* basub, coord_t* ortho_tmp, FILE* file) {
+    for(long first = 0; first < points->n_points; first += chunk_points) {
+        long n = MIN(chunk_points, points->n_points - first);
+        read_points(points, first, n, chunk);
+        calc_orthogonal_projections(chunk, n, a, b, basub, ortho_tmp, chunk_values);
+        write_values(file, chunk_values, sizeof(double), n);
+    }
+    fflush(file);
+}
+
+/*
+Returns the position of the first of the n sorted values not smaller than value
+*/
+static long lower_bound(double* values, long n, double value) {
+    long low = 0;
+    while(n > 0) {
+        long half = n / 2;
+        if(values[low + half] < value) {
+            low += half + 1;
+            n -= half + 1;
+        }
+        else {
+            n = half;
+        }
+    }
+    return low;
+}
+
+static int in_bracket(double value, double low, double high) {
+    return value >= low && (value < high || high == INFINITY);
+}
+
+/*
+Returns the k-th smallest of the n projection parameters in file fd.
+Each round keeps the values in the bracket [low, high) holding the k-th one: it picks up to SELECT_SAMPLE pivots
+evenly among them, counts the values equal to each pivot and between consecutive pivots, and narrows the bracket
+to the pivot or the gap between pivots holding the k-th value. Pivots are never in the next bracket, so every round
+makes it smaller. Once the bracket fits in select_capacity its values are selected in memory
+*/
+static double select_spilled(int fd, long n, long k) {
+    double low = -INFINITY;
+    double high = INFINITY;
+    long below = 0; // values smaller than low
+    long count = n; // values in the bracket
+    double* values = (double*) malloc(select_capacity * sizeof(double));
+    long* counts = (long*) malloc((2 * SELECT_SAMPLE + 1) * sizeof(long));
+    if(values == NULL || counts == NULL) {
+        fprintf(stderr, "Error allocating the median selection, exiting.\n");
+        exit(4);
+    }
+
+    for(;;) {
+        long stride = count <= select_capacity ? 1 : (count + SELECT_SAMPLE - 1) / SELECT_SAMPLE;
+        long n_values = 0;
+        long seen = 0;
+        for(long first = 0; first < n; first += chunk_points) {
+            long m = MIN(chunk_points, n - first);
+            read_bytes(fd, first * sizeof(double), chunk_values, m * sizeof(double));
+            for(long i = 0; i < m; i++) {
+                if(in_bracket(chunk_values[i], low, high) && seen++ % stride == 0) {
+                    values[n_values++] = chunk_values[i];
+                }
+            }
+        }
+        if(stride == 1) {
+            select_double(values, n_values, k - below);
+            double value = values[k - below];
+            free(values);
+            free(counts);
+            return value;
+        }
+
+        qsort(values, n_values, sizeof(double), compare_double);
+        long n_pivots = 0;
+        for(long i = 0; i < n_values; i++) {
+            if(n_pivots == 0 || values[i] != values[n_pivots - 1]) {
+                values[n_pivots++] = values[i];
+            }
+        }
+
+        // counts[2 * j + 1] holds the values equal to pivot j, counts[2 * j] those between pivots j - 1 and j
+        memset(counts, 0, (2 * n_pivots + 1) * sizeof(long));
+        for(long first = 0; first < n; first += chunk_points) {
+            long m = MIN(chunk_points, n - first);
+            read_bytes(fd, first * sizeof(double), chunk_values, m * sizeof(double));
+            for(long i = 0; i < m; i++) {
+                double value = chunk_values[i];
+                if(in_bracket(value, low, high)) {
+                    long j = lower_bound(values, n_pivots, value);
+                    counts[2 * j + (j < n_pivots && values[j] == value)]++;
+                }
+            }
+        }
+
+        long bucket = 0;
+        while(k - below >= counts[bucket]) {
+            below += counts[bucket];
+            bucket++;
+        }
+        if(bucket % 2) {
+            double value = values[bucket / 2];
+            free(values);
+            free(counts);
+            return value;
+        }
+        low = bucket == 0 ? low : nextafter(values[bucket / 2 - 1], INFINITY);
+        high = bucket == 2 * n_pivots ? high : values[bucket / 2];
+        count = counts[bucket];
+    }
+}
+
+/*
+Returns the largest of the n projection parameters in file fd smaller than value, or value if fewer than k are smaller
+*/
+static double largest_below(int fd, long n, long k, double value) {
+    double largest = -INFINITY;
+    long smaller = 0;
+    for(long first = 0; first < n; first += chunk_points) {
+        long m = MIN(chunk_points, n - first);
+        read_bytes(fd, first * sizeof(double), chunk_values, m * sizeof(double));
+        for(long i = 0; i < m; i++) {
+            if(chunk_values[i] < value) {
+                smaller++;
+                largest = MAX(largest, chunk_values[i]);
+            }
+        }
+    }
+    return smaller >= k ? largest : value;
+}
+
+/*
+Places in center the median projection, like get_center, and returns the upper middle projection parameter
+*/
+static double spilled_center(int fd, long n_points, coord_t* basub, coord_t* a, coord_t* ortho_tmp, coord_t* center) {
+    double second_middle = select_spilled(fd, n_points, n_points / 2);
+    if(n_points % 2) { // is odd
+        projection_point(basub, a, second_middle, center);
+    }
+    else { // is even
+        double first_middle = largest_below(fd, n_points, n_points / 2, second_middle);
+        projection_point(basub, a, first_middle, ortho_tmp);
+        projection_point(basub, a, second_middle, center);
+        middle_point(ortho_tmp, center, center);
+    }
+    return second_middle;
+}
+
+/*
+Returns how many of the n projection parameters in file fd are smaller than value
+*/
+static long count_below(int fd, long n, double value) {
+    long smaller = 0;
+    for(long first = 0; first < n; first += chunk_points) {
+        long m = MIN(chunk_points, n - first);
+        read_bytes(fd, first * sizeof(double), chunk_values, m * sizeof(double));
+        for(long i = 0; i < m; i++) {
+            smaller += chunk_values[i] < value;
+        }
+    }
+    return smaller;
+}
+
+/*
+Writes each point to file left or right by comparing its projection parameter in file fd with split, keeping their order.
+Like fill_partitions, the first points equal to split go to left until it has n_points_left points
+*/
+static void spill_partitions(point_file_t* points, int fd, FILE* left, FILE* right, double split, long n_points_left) {
+    long ties = n_points_left - count_below(fd, points->n_points, split); // points equal to split that go to left
+    for(long first = 0; first < points->n_points; first += chunk_points) {
+        long n = MIN(chunk_points, points->n_points - first);
+        read_points(points, first, n, chunk);
+        read_bytes(fd, first * sizeof(double), chunk_values, n * sizeof(double));
+        for(long i = 0; i < n; i++) {
+            int tie = chunk_values[i] == split && ties > 0;
+            ties -= tie;
+            write_values(chunk_values[i] < split || tie ? left : right, chunk[i], sizeof(coord_t), n_dims);
+        }
+    }
+}
+
+static void seek_tree_out(long offset) {
+    if(fseeko(tree_out, offset, SEEK_SET)) {
+        fprintf(stderr, "Cannot seek in the tree output, exiting.\n");
+        exit(5);
+    }
+}
+
+/*
+Writes the nodes in node_list, which take the slots of the tree from node_index on, and the points of their leaves,
+which are the points of the tree from leaf_points_offset on
+*/
+static void write_nodes(long node_index) {
+    if(!build_options.binary_format) {
+        dump_tree(tree_out);
+        return;
+    }
+    seek_tree_out(TREE_FILE_NODES_OFFSET + node_index * (long) sizeof(struct tree_file_node));
+    dump_tree_binary_nodes(tree_out);
+    seek_tree_out(TREE_FILE_CENTERS_OFFSET(n_tree_nodes) + node_index * n_dims * (long) sizeof(coord_t));
+    dump_tree_binary_centers(tree_out);
+    if(leaf_point_counter > 0) {
+        seek_tree_out(TREE_FILE_POINTS_OFFSET(n_tree_nodes, n_dims, sizeof(coord_t)) + leaf_points_offset * n_dims * (long) sizeof(coord_t));
+        dump_tree_binary_points(tree_out);
+    }
+}
+
+static void free_array_pts(coord_t** pts) {
+    if(pts != NULL) {
+        free(pts[0]);
+        free(pts);
+    }
+}
+
+/*
+Reads the points into memory and builds their subtree with build_tree, then writes it
+*/
+static void build_subtree_in_memory(point_file_t* points, long node_id, long node_index, long point_index) {
+    long n_points = points->n_points;
+    long n_nodes = count_tree_nodes(n_points);
+    coord_t** pts = create_array_pts(n_dims, n_points);
+    double* ortho_array = (double*) malloc(sizeof(double) * n_points);
+    double* ortho_array_srt = (double*) malloc(sizeof(double) * n_points);
+    node_list = (node_ptr) malloc(sizeof(node_t) * n_nodes);
+    node_centers = create_array_pts(n_dims, n_nodes);
+    leaf_points = build_options.leaf_size > 1 ? create_array_pts(n_dims, n_points) : NULL;
+    if(ortho_array == NULL || ortho_array_srt == NULL || node_list == NULL) {
+        fprintf(stderr, "Error allocating the subtree, exiting.\n");
+        exit(4);
+    }
+    read_points(points, 0, n_points, pts);
+
+    if(build_options.soa_layout) {
+        build_tree_from_soa(pts, ortho_array, ortho_array_srt, leaf_points, n_points, node_id, 0);
+    }
+    else {
+        coord_t** pts_aux = create_array_pts(n_dims, n_points);
+        #pragma omp taskgroup
+        build_tree(pts, pts_aux, ortho_array, ortho_array_srt, leaf_points, n_points, node_id, 0);
+        free_array_pts(pts_aux);
+    }
+
+    node_counter = n_nodes;
+    leaf_point_counter = leaf_points != NULL ? n_points : 0;
+    leaf_points_offset = point_index;
+    write_nodes(node_index);
+
+    free_array_pts(pts);
+    free(ortho_array);
+    free(ortho_array_srt);
+    free(node_list);
+    free_array_pts(node_centers);
+    free_array_pts(leaf_points);
+}
+
+/*
+Builds the subtree with id node_id of the points, which take the node slots from node_index on and the points
+of the tree from point_index on, and closes the points.
+Nodes are written before their children, so the text tree comes out in the same order as from build_tree
+*/
+static void build_node_out_of_core(point_file_t* points, long node_id, long node_index, long point_index) {
+    long n_points = points->n_points;
+    if(n_points <= memory_points || n_points <= build_options.leaf_size) {
+        build_subtree_in_memory(points, node_id, node_index, point_index);
+        close_point_file(points);
+        return;
+    }
+
+    coord_t first[n_dims]; // first point, where the furthest point scans start
+    coord_t a[n_dims]; // furthest point from the first point
+    coord_t b[n_dims]; // furthest point from a
+    coord_t basub[n_dims]; // b-a for the orthogonal projections
+    coord_t ortho_tmp[n_dims]; // temporary point used for calculating the orthogonal projections
+    coord_t center[n_dims];
+    coord_t furthest[n_dims]; // furthest point from the center
+
+    read_points(points, 0, 1, chunk);
+    copy_point(chunk[0], first);
+    furthest_point(points, first, a);
+    furthest_point(points, a, b);
+
+    FILE* projections = create_spill_file();
+    project_points(points, a, b, basub, ortho_tmp, projections);
+    double split = spilled_center(fileno(projections), n_points, basub, a, ortho_tmp, center);
+    furthest_point(points, center, furthest);
+    double radius = sqrt(distance(furthest, center));
+
+    long n_points_left = LEFT_PARTITION_SIZE(n_points);
+    long n_points_right = RIGHT_PARTITION_SIZE(n_points);
+
+    long node_id_left = 2 * node_id + 1;
+    long node_id_right = 2 * node_id + 2;
+
+    long node_index_left = node_index + 1;
+    long node_index_right = node_index + 1 + count_tree_nodes(n_points_left);
+
+    node_t node;
+    make_node(node_id, center, radius, &node);
+    node.left_id = node_id_left;
+    node.right_id = node_id_right;
+    node_list = &node;
+    node_counter = 1;
+    leaf_point_counter = 0;
+    write_nodes(node_index);
+
+    FILE* left = create_spill_file();
+    FILE* right = create_spill_file();
+    spill_partitions(points, fileno(projections), left, right, split, n_points_left);
+    fclose(projections);
+    close_point_file(points);
+
+    point_file_t left_points = spilled_points(left, n_points_left);
+    build_node_out_of_core(&left_points, node_id_left, node_index_left, point_index);
+    point_file_t right_points = spilled_points(right, n_points_right);
+    build_node_out_of_core(&right_points, node_id_right, node_index_right, point_index + n_points_left);
+}
+
+void build_tree_out_of_core(int argc, char** argv, FILE* out) {
+    point_file_t points;
+    long n_points;
+    if(build_options.input_path != NULL) {
+        struct points_file_header header;
+        if(argc != 1) {
+            printf("Usage: %s --input <points-file>, without <n_dims> <n_points> <seed>\n", argv[0]);
+            exit(1);
+        }
+        int fd = open_points_file(build_options.input_path, &header, &n_points);
+        n_dims = header.n_dims;
+        points = (point_file_t) { NULL, fd, sizeof(header), header.coord_size, n_points };
+    }
+    else {
+        FILE* file = create_spill_file();
+        write_points(argc, argv, file, &n_dims, &n_points);
+        points = spilled_points(file, n_points);
+    }
+    init_point_kernels(n_dims);
+
+    tree_out = out;
+    n_tree_nodes = count_tree_nodes(n_points);
+    memory_points = MAX(build_options.memory_budget / in_memory_point_size(), 1);
+    chunk_points = MAX(MIN(build_options.memory_budget / 4, SCAN_CHUNK_BYTES) / (n_dims * (long) sizeof(coord_t) + (long) sizeof(double)), 1);
+    select_capacity = MAX(build_options.memory_budget / (2 * (long) sizeof(double)), SELECT_SAMPLE);
+    chunk = create_array_pts(n_dims, chunk_points);
+    chunk_values = (double*) malloc(chunk_points * sizeof(double));
+
+    if(build_options.binary_format) {
+        if(fseeko(out, 0, SEEK_SET)) {
+            fprintf(stderr, "Binary trees built with a memory budget are written in place, the output must be a file (--output).\n");
+            exit(5);
+        }
+        dump_tree_binary_header(out, n_tree_nodes);
+    }
+    else if(build_options.leaf_size > 1) {
+        fprintf(out, "%d %ld %ld\n", n_dims, n_tree_nodes, n_points);
+    }
+    else {
+        fprintf(out, "%d %ld\n", n_dims, n_tree_nodes);
+    }
+
+    #pragma omp parallel
+    #pragma omp single
+    build_node_out_of_core(&points, 0, 0, 0);
+
+    free_array_pts(chunk);
+    free(chunk_values);
+}
@@ -0,0 +1,21 @@
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include <stdio.h>
+
+/*
+External memory construction of the ball tree, used by ballAlg with --memory-budget for datasets larger than memory.
+The points stay in files: the points file of --input, or a temporary file the generated points are written to.
+The nodes of more points than fit in the budget are built by scans over their file, a chunk of points at a time:
+the furthest point scans, the projections, which are written to a temporary file, the median selection over
+that file and the partitioning of the points into a temporary file per child.
+Subtrees that fit in the budget are read into memory and built by build_tree.
+The computations are those of build_tree in the same order, so the tree is identical to the one built in memory.
+Temporary files go to --spill-dir and are removed as soon as the nodes that use them are built.
+*/
+
+//Builds the tree of the points given by the arguments (or by --input) and writes it to out as it is built.
+//Binary trees are written in place, so out must be seekable
+void build_tree_out_of_core(int argc, char** argv, FILE* out);
+
+#endif
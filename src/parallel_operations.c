@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "point_operations.h"
+#include "parallel_operations.h"
+#include "point_kernels.h"
+#include "macros.h"
+
+#define CHUNKS_PER_THREAD 4 // chunks each scan is split in per thread, to balance chunks that finish at different times
+
+extern int n_dims; // number of dimensions of each point
+
+/*
+Returns the number of chunks the scans are split in
+*/
+static long get_n_chunks(long n_points) {
+    long n_chunks = omp_get_num_threads() * CHUNKS_PER_THREAD;
+    return MIN(n_chunks, n_points);
+}
+
+/*
+Returns the point in pts furthest away from point p.
+Each chunk finds its own furthest point and the chunks are combined in order,
+so on ties the point with the lowest index is returned, like in the serial scan
+*/
+coord_t* parallel_get_furthest_away_point(coord_t** pts, long n_points, coord_t* p) {
+    long n_chunks = get_n_chunks(n_points);
+    double chunk_max_distance[n_chunks];
+    coord_t* chunk_furthest_point[n_chunks];
+
+    #pragma omp taskloop grainsize(1) shared(chunk_max_distance, chunk_furthest_point)
+    for(long c = 0; c < n_chunks; c++) {
+        long low = BLOCK_LOW(c, n_chunks, n_points);
+        long furthest = point_kernels.furthest_point(pts + low, BLOCK_SIZE(c, n_chunks, n_points), p, &chunk_max_distance[c]);
+        chunk_furthest_point[c] = furthest < 0 ? p : pts[low + furthest];
+    }
+
+    double max_distance = 0.0;
+    coord_t* furthest_point = p;
+    for(long c = 0; c < n_chunks; c++) {
+        if(chunk_max_distance[c] > max_distance) {
+            max_distance = chunk_max_distance[c];
+            furthest_point = chunk_furthest_point[c];
+        }
+    }
+    return furthest_point;
+}
+
+/*
+Puts in out the projection parameters of points in pts onto line starting in a and defined by basub
+*/
+void parallel_projection_parameters(coord_t** pts, long n_points, coord_t* basub, coord_t* a, double* out) {
+    long n_chunks = get_n_chunks(n_points);
+
+    #pragma omp taskloop grainsize(1)
+    for(long c = 0; c < n_chunks; c++) {
+        long low = BLOCK_LOW(c, n_chunks, n_points);
+        point_kernels.projection_parameters(pts + low, BLOCK_SIZE(c, n_chunks, n_points), basub, a, out + low);
+    }
+}
+
+/*
+Places in left_offset and right_offset the offsets in the left and right partitions of the points of each of
+the n_chunks chunks, and in ties how many of the points of each chunk equal to split go to the left partition.
+Each chunk counts its points smaller than and equal to split, the points equal to split fill the left partition
+up to n_points_left in the order of the chunks, and an exclusive prefix sum of the counts gives the offsets
+*/
+void parallel_partition_offsets(double* ortho_array, long n_points, long n_chunks, double split, long n_points_left, long* left_offset, long* right_offset, long* ties) {
+    #pragma omp taskloop grainsize(1)
+    for(long c = 0; c < n_chunks; c++) {
+        long smaller = 0;
+        long equal = 0;
+        for(long i = BLOCK_LOW(c, n_chunks, n_points); i <= BLOCK_HIGH(c, n_chunks, n_points); i++) {
+            smaller += ortho_array[i] < split;
+            equal += ortho_array[i] == split;
+        }
+        left_offset[c] = smaller;
+        ties[c] = equal;
+    }
+
+    long ties_left = n_points_left;
+    for(long c = 0; c < n_chunks; c++) {
+        ties_left -= left_offset[c];
+    }
+
+    long l = 0;
+    long r = 0;
+    for(long c = 0; c < n_chunks; c++) {
+        ties[c] = MIN(ties[c], ties_left);
+        ties_left -= ties[c];
+        long count = left_offset[c] + ties[c];
+        left_offset[c] = l;
+        right_offset[c] = r;
+        l += count;
+        r += BLOCK_SIZE(c, n_chunks, n_points) - count;
+    }
+}
+
+/*
+Copies the n_points_left points in pts with the smallest projection parameters to left and the others to right,
+like the serial partition: the points smaller than split and then the first ones equal to split go to left.
+The offsets of each chunk are found by parallel_partition_offsets and then the chunks copy their points independently.
+The points keep the order they have in pts
+*/
+void parallel_fill_partitions(coord_t** pts, long n_points, double* ortho_array, coord_t** left, coord_t** right, double split, long n_points_left) {
+    long n_chunks = get_n_chunks(n_points);
+    long chunk_left_offset[n_chunks];
+    long chunk_right_offset[n_chunks];
+    long chunk_ties[n_chunks];
+    parallel_partition_offsets(ortho_array, n_points, n_chunks, split, n_points_left, chunk_left_offset, chunk_right_offset, chunk_ties);
+
+    #pragma omp taskloop grainsize(1) shared(chunk_left_offset, chunk_right_offset, chunk_ties)
+    for(long c = 0; c < n_chunks; c++) {
+        long l = chunk_left_offset[c];
+        long r = chunk_right_offset[c];
+        long ties = chunk_ties[c];
+        for(long i = BLOCK_LOW(c, n_chunks, n_points); i <= BLOCK_HIGH(c, n_chunks, n_points); i++) {
+            int tie = ortho_array[i] == split && ties > 0;
+            ties -= tie;
+            if(ortho_array[i] < split || tie) {
+                copy_point(pts[i], left[l]);
+                l++;
+            }
+            else {
+                copy_point(pts[i], right[r]);
+                r++;
+            }
+        }
+    }
+}
+
+/*
+Merges the sorted ranges src[low..middle) and src[middle..high) into dst[low..high)
+*/
+static void merge_doubles(double* src, long low, long middle, long high, double* dst) {
+    long i = low;
+    long j = middle;
+    for(long k = low; k < high; k++) {
+        if(j == high || (i < middle && src[i] <= src[j])) {
+            dst[k] = src[i++];
+        }
+        else {
+            dst[k] = src[j++];
+        }
+    }
+}
+
+/*
+Sorts values in ascending order.
+Each chunk is sorted with qsort and then chunks are merged pairwise,
+every round of merges running in parallel
+*/
+void parallel_sort_doubles(double* values, long n) {
+    long n_chunks = get_n_chunks(n);
+    double* buffer = (double*) malloc(sizeof(double) * n);
+    double* src = values;
+    double* dst = buffer;
+
+    #pragma omp taskloop grainsize(1)
+    for(long c = 0; c < n_chunks; c++) {
+        qsort(values + BLOCK_LOW(c, n_chunks, n), BLOCK_SIZE(c, n_chunks, n), sizeof(double), compare_double);
+    }
+
+    for(long width = 1; width < n_chunks; width *= 2) {
+        #pragma omp taskloop grainsize(1) firstprivate(src, dst)
+        for(long c = 0; c < n_chunks; c += 2 * width) {
+            long low = BLOCK_LOW(c, n_chunks, n);
+            long middle = BLOCK_LOW(MIN(c + width, n_chunks), n_chunks, n);
+            long high = BLOCK_LOW(MIN(c + 2 * width, n_chunks), n_chunks, n);
+            merge_doubles(src, low, middle, high, dst);
+        }
+        double* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if(src != values) {
+        memcpy(values, src, sizeof(double) * n);
+    }
+    free(buffer);
+}
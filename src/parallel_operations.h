@@ -0,0 +1,34 @@
+#ifndef PARALLEL_OPERATIONS_H
+#define PARALLEL_OPERATIONS_H
+
+#include <omp.h>
+#include "coords.h"
+
+/*
+Data parallel versions of the point scans of the builders, for the top levels of the tree
+where there are too few nodes for task parallelism.
+Work is split in chunks run as OpenMP tasks, so they must be called by one thread of a parallel region
+(e.g. inside a single construct or a task). Results are the same as the serial scans.
+*/
+
+#define PARALLEL_SCAN_CUTOFF 65536 // scans over more than this many points are split among the threads
+
+// True when a scan over n points is worth splitting among the threads
+#define USE_PARALLEL_SCANS(N) ((N) > PARALLEL_SCAN_CUTOFF && omp_get_num_threads() > 1)
+
+//Returns the point in pts furthest away from point p, the first one found on ties
+coord_t* parallel_get_furthest_away_point(coord_t** pts, long n_points, coord_t* p);
+
+//Puts in out the projection parameters of points in pts onto line starting in a and defined by basub
+void parallel_projection_parameters(coord_t** pts, long n_points, coord_t* basub, coord_t* a, double* out);
+
+//Finds the offsets in left and right of the points of each of n_chunks chunks, and how many points equal to split each places in left
+void parallel_partition_offsets(double* ortho_array, long n_points, long n_chunks, double split, long n_points_left, long* left_offset, long* right_offset, long* ties);
+
+//Copies the n_points_left points in pts with the smallest projection parameters to left and the others to right, keeping their order
+void parallel_fill_partitions(coord_t** pts, long n_points, double* ortho_array, coord_t** left, coord_t** right, double split, long n_points_left);
+
+//Sorts values in ascending order
+void parallel_sort_doubles(double* values, long n);
+
+#endif
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "point_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+#define BOUND_CHECK_DIMS 4 // dimensions added up between the checks of sq_distance_bounded
+
+struct point_kernels point_kernels;
+
+static int kernel_dims; // number of dimensions used by the variants that are not specialized
+
+/***********************************************************************************************************************************************/
+/************************************************************** Scalar kernels *****************************************************************/
+/***********************************************************************************************************************************************/
+
+ALWAYS_INLINE double sq_distance_body(coord_t* pt1, coord_t* pt2, int dims) {
+    double dist = 0.0;
+    for(int d = 0; d < dims; d++) {
+        double diff = (double) pt1[d] - pt2[d];
+        dist += diff * diff;
+    }
+    return dist;
+}
+
+ALWAYS_INLINE double sq_distance_bounded_body(coord_t* pt1, coord_t* pt2, double bound, int dims) {
+    double dist = 0.0;
+    int d = 0;
+    while(d + BOUND_CHECK_DIMS < dims) {
+        for(int end = d + BOUND_CHECK_DIMS; d < end; d++) {
+            double diff = (double) pt1[d] - pt2[d];
+            dist += diff * diff;
+        }
+        if(dist > bound)
+            return dist;
+    }
+    for(; d < dims; d++) {
+        double diff = (double) pt1[d] - pt2[d];
+        dist += diff * diff;
+    }
+    return dist;
+}
+
+ALWAYS_INLINE double projection_parameter_body(coord_t* basub, coord_t* a, coord_t* p, int dims) {
+    double c = 0.0;
+    for(int d = 0; d < dims; d++)
+        c += ((double) p[d] - a[d]) * basub[d];
+    return c;
+}
+
+/*
+Finishes a furthest point scan: combines the per lane maximums (the lowest index wins on ties)
+and then scans the points from index i on that did not fill a whole vector
+*/
+ALWAYS_INLINE long furthest_point_tail(double* lane_max, double* lane_index, int n_lanes, coord_t** pts, long i, long n_points, coord_t* p, int dims, double* max_distance) {
+    double max = 0.0;
+    long furthest = -1;
+    for(int l = 0; l < n_lanes; l++) {
+        if(lane_max[l] > max || (lane_max[l] == max && lane_index[l] >= 0 && (long) lane_index[l] < furthest)) {
+            max = lane_max[l];
+            furthest = (long) lane_index[l];
+        }
+    }
+    for(; i < n_points; i++) {
+        double dist = sq_distance_body(p, pts[i], dims);
+        if(dist > max) {
+            max = dist;
+            furthest = i;
+        }
+    }
+    *max_distance = max;
+    return furthest;
+}
+
+ALWAYS_INLINE long furthest_point_body_scalar(coord_t** pts, long n_points, coord_t* p, int dims, double* max_distance) {
+    return furthest_point_tail(NULL, NULL, 0, pts, 0, n_points, p, dims, max_distance);
+}
+
+ALWAYS_INLINE void sq_distances_body_scalar(coord_t* pts, long n_points, coord_t* p, int dims, double* out) {
+    for(long i = 0; i < n_points; i++)
+        out[i] = sq_distance_body(p, pts + i * dims, dims);
+}
+
+ALWAYS_INLINE void projection_parameters_body_scalar(coord_t** pts, long n_points, coord_t* basub, coord_t* a, int dims, double* out) {
+    for(long i = 0; i < n_points; i++)
+        out[i] = projection_parameter_body(basub, a, pts[i], dims);
+}
+
+/***********************************************************************************************************************************************/
+/************************************************ Vectorized kernels, one point per vector lane ************************************************/
+/***********************************************************************************************************************************************/
+
+#ifdef X86_KERNELS
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+ALWAYS_INLINE TARGET_SSE2 long furthest_point_body_sse2(coord_t** pts, long n_points, coord_t* p, int dims, double* max_distance) {
+    __m128d lane_max = _mm_setzero_pd();
+    __m128d lane_index = _mm_set1_pd(-1.0);
+    __m128d index = _mm_set_pd(1.0, 0.0);
+    const __m128d step = _mm_set1_pd(2.0);
+    long i = 0;
+    for(; i + 2 <= n_points; i += 2) {
+        coord_t *r0 = pts[i], *r1 = pts[i + 1];
+        __m128d dist = _mm_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m128d diff = _mm_sub_pd(_mm_set1_pd(p[d]), _mm_set_pd(r1[d], r0[d]));
+            dist = _mm_add_pd(dist, _mm_mul_pd(diff, diff));
+        }
+        __m128d greater = _mm_cmpgt_pd(dist, lane_max);
+        lane_max = _mm_or_pd(_mm_and_pd(greater, dist), _mm_andnot_pd(greater, lane_max));
+        lane_index = _mm_or_pd(_mm_and_pd(greater, index), _mm_andnot_pd(greater, lane_index));
+        index = _mm_add_pd(index, step);
+    }
+    double maxs[2], indexes[2];
+    _mm_storeu_pd(maxs, lane_max);
+    _mm_storeu_pd(indexes, lane_index);
+    return furthest_point_tail(maxs, indexes, 2, pts, i, n_points, p, dims, max_distance);
+}
+
+ALWAYS_INLINE TARGET_SSE2 void sq_distances_body_sse2(coord_t* pts, long n_points, coord_t* p, int dims, double* out) {
+    long i = 0;
+    for(; i + 2 <= n_points; i += 2) {
+        coord_t *r0 = pts + i * dims, *r1 = r0 + dims;
+        __m128d dist = _mm_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m128d diff = _mm_sub_pd(_mm_set1_pd(p[d]), _mm_set_pd(r1[d], r0[d]));
+            dist = _mm_add_pd(dist, _mm_mul_pd(diff, diff));
+        }
+        _mm_storeu_pd(out + i, dist);
+    }
+    for(; i < n_points; i++)
+        out[i] = sq_distance_body(p, pts + i * dims, dims);
+}
+
+ALWAYS_INLINE TARGET_SSE2 void projection_parameters_body_sse2(coord_t** pts, long n_points, coord_t* basub, coord_t* a, int dims, double* out) {
+    long i = 0;
+    for(; i + 2 <= n_points; i += 2) {
+        coord_t *r0 = pts[i], *r1 = pts[i + 1];
+        __m128d c = _mm_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m128d diff = _mm_sub_pd(_mm_set_pd(r1[d], r0[d]), _mm_set1_pd(a[d]));
+            c = _mm_add_pd(c, _mm_mul_pd(diff, _mm_set1_pd(basub[d])));
+        }
+        _mm_storeu_pd(out + i, c);
+    }
+    for(; i < n_points; i++)
+        out[i] = projection_parameter_body(basub, a, pts[i], dims);
+}
+
+ALWAYS_INLINE TARGET_AVX2 long furthest_point_body_avx2(coord_t** pts, long n_points, coord_t* p, int dims, double* max_distance) {
+    __m256d lane_max = _mm256_setzero_pd();
+    __m256d lane_index = _mm256_set1_pd(-1.0);
+    __m256d index = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+    const __m256d step = _mm256_set1_pd(4.0);
+    long i = 0;
+    for(; i + 4 <= n_points; i += 4) {
+        coord_t *r0 = pts[i], *r1 = pts[i + 1], *r2 = pts[i + 2], *r3 = pts[i + 3];
+        __m256d dist = _mm256_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m256d diff = _mm256_sub_pd(_mm256_set1_pd(p[d]), _mm256_set_pd(r3[d], r2[d], r1[d], r0[d]));
+            dist = _mm256_add_pd(dist, _mm256_mul_pd(diff, diff));
+        }
+        __m256d greater = _mm256_cmp_pd(dist, lane_max, _CMP_GT_OQ);
+        lane_max = _mm256_blendv_pd(lane_max, dist, greater);
+        lane_index = _mm256_blendv_pd(lane_index, index, greater);
+        index = _mm256_add_pd(index, step);
+    }
+    double maxs[4], indexes[4];
+    _mm256_storeu_pd(maxs, lane_max);
+    _mm256_storeu_pd(indexes, lane_index);
+    return furthest_point_tail(maxs, indexes, 4, pts, i, n_points, p, dims, max_distance);
+}
+
+ALWAYS_INLINE TARGET_AVX2 void sq_distances_body_avx2(coord_t* pts, long n_points, coord_t* p, int dims, double* out) {
+    long i = 0;
+    for(; i + 4 <= n_points; i += 4) {
+        coord_t *r0 = pts + i * dims, *r1 = r0 + dims, *r2 = r1 + dims, *r3 = r2 + dims;
+        __m256d dist = _mm256_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m256d diff = _mm256_sub_pd(_mm256_set1_pd(p[d]), _mm256_set_pd(r3[d], r2[d], r1[d], r0[d]));
+            dist = _mm256_add_pd(dist, _mm256_mul_pd(diff, diff));
+        }
+        _mm256_storeu_pd(out + i, dist);
+    }
+    for(; i < n_points; i++)
+        out[i] = sq_distance_body(p, pts + i * dims, dims);
+}
+
+ALWAYS_INLINE TARGET_AVX2 void projection_parameters_body_avx2(coord_t** pts, long n_points, coord_t* basub, coord_t* a, int dims, double* out) {
+    long i = 0;
+    for(; i + 4 <= n_points; i += 4) {
+        coord_t *r0 = pts[i], *r1 = pts[i + 1], *r2 = pts[i + 2], *r3 = pts[i + 3];
+        __m256d c = _mm256_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m256d diff = _mm256_sub_pd(_mm256_set_pd(r3[d], r2[d], r1[d], r0[d]), _mm256_set1_pd(a[d]));
+            c = _mm256_add_pd(c, _mm256_mul_pd(diff, _mm256_set1_pd(basub[d])));
+        }
+        _mm256_storeu_pd(out + i, c);
+    }
+    for(; i < n_points; i++)
+        out[i] = projection_parameter_body(basub, a, pts[i], dims);
+}
+
+ALWAYS_INLINE TARGET_AVX512 long furthest_point_body_avx512(coord_t** pts, long n_points, coord_t* p, int dims, double* max_distance) {
+    __m512d lane_max = _mm512_setzero_pd();
+    __m512d lane_index = _mm512_set1_pd(-1.0);
+    __m512d index = _mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0);
+    const __m512d step = _mm512_set1_pd(8.0);
+    long i = 0;
+    for(; i + 8 <= n_points; i += 8) {
+        coord_t **r = pts + i;
+        __m512d dist = _mm512_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m512d v = _mm512_set_pd(r[7][d], r[6][d], r[5][d], r[4][d], r[3][d], r[2][d], r[1][d], r[0][d]);
+            __m512d diff = _mm512_sub_pd(_mm512_set1_pd(p[d]), v);
+            dist = _mm512_add_pd(dist, _mm512_mul_pd(diff, diff));
+        }
+        __mmask8 greater = _mm512_cmp_pd_mask(dist, lane_max, _CMP_GT_OQ);
+        lane_max = _mm512_mask_blend_pd(greater, lane_max, dist);
+        lane_index = _mm512_mask_blend_pd(greater, lane_index, index);
+        index = _mm512_add_pd(index, step);
+    }
+    double maxs[8], indexes[8];
+    _mm512_storeu_pd(maxs, lane_max);
+    _mm512_storeu_pd(indexes, lane_index);
+    return furthest_point_tail(maxs, indexes, 8, pts, i, n_points, p, dims, max_distance);
+}
+
+ALWAYS_INLINE TARGET_AVX512 void sq_distances_body_avx512(coord_t* pts, long n_points, coord_t* p, int dims, double* out) {
+    long i = 0;
+    for(; i + 8 <= n_points; i += 8) {
+        coord_t *r = pts + i * dims;
+        __m512d dist = _mm512_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m512d v = _mm512_set_pd(r[7 * dims + d], r[6 * dims + d], r[5 * dims + d], r[4 * dims + d],
+                                      r[3 * dims + d], r[2 * dims + d], r[dims + d], r[d]);
+            __m512d diff = _mm512_sub_pd(_mm512_set1_pd(p[d]), v);
+            dist = _mm512_add_pd(dist, _mm512_mul_pd(diff, diff));
+        }
+        _mm512_storeu_pd(out + i, dist);
+    }
+    for(; i < n_points; i++)
+        out[i] = sq_distance_body(p, pts + i * dims, dims);
+}
+
+ALWAYS_INLINE TARGET_AVX512 void projection_parameters_body_avx512(coord_t** pts, long n_points, coord_t* basub, coord_t* a, int dims, double* out) {
+    long i = 0;
+    for(; i + 8 <= n_points; i += 8) {
+        coord_t **r = pts + i;
+        __m512d c = _mm512_setzero_pd();
+        for(int d = 0; d < dims; d++) {
+            __m512d v = _mm512_set_pd(r[7][d], r[6][d], r[5][d], r[4][d], r[3][d], r[2][d], r[1][d], r[0][d]);
+            __m512d diff = _mm512_sub_pd(v, _mm512_set1_pd(a[d]));
+            c = _mm512_add_pd(c, _mm512_mul_pd(diff, _mm512_set1_pd(basub[d])));
+        }
+        _mm512_storeu_pd(out + i, c);
+    }
+    for(; i < n_points; i++)
+        out[i] = projection_parameter_body(basub, a, pts[i], dims);
+}
+
+#endif
+
+/***********************************************************************************************************************************************/
+/******************************************* Instantiation of every kernel for every specialized dimension **************************************/
+/***********************************************************************************************************************************************/
+
+// Dimensions with specialized kernels, SPECIALIZED_DIMS(X) expands X(n) for each of them
+#define SPECIALIZED_DIMS(X) X(2) X(3) X(4) X(8) X(16) X(20)
+
+#define DEFINE_SQ_DISTANCE(DIMS) \
+    static double sq_distance_##DIMS(coord_t* pt1, coord_t* pt2) { return sq_distance_body(pt1, pt2, DIMS); } \
+    static double sq_distance_bounded_##DIMS(coord_t* pt1, coord_t* pt2, double bound) { \
+        return sq_distance_bounded_body(pt1, pt2, bound, DIMS); \
+    }
+
+#define DEFINE_KERNELS(ISA, TARGET, DIMS, SUFFIX) \
+    static TARGET long furthest_point_##ISA##_##SUFFIX(coord_t** pts, long n_points, coord_t* p, double* max_distance) { \
+        return furthest_point_body_##ISA(pts, n_points, p, DIMS, max_distance); \
+    } \
+    static TARGET void sq_distances_##ISA##_##SUFFIX(coord_t* pts, long n_points, coord_t* p, double* out) { \
+        sq_distances_body_##ISA(pts, n_points, p, DIMS, out); \
+    } \
+    static TARGET void projection_parameters_##ISA##_##SUFFIX(coord_t** pts, long n_points, coord_t* basub, coord_t* a, double* out) { \
+        projection_parameters_body_##ISA(pts, n_points, basub, a, DIMS, out); \
+    }
+
+#define DEFINE_SCALAR_KERNELS(DIMS) DEFINE_KERNELS(scalar, , DIMS, DIMS)
+
+static double sq_distance_any(coord_t* pt1, coord_t* pt2) { return sq_distance_body(pt1, pt2, kernel_dims); }
+static double sq_distance_bounded_any(coord_t* pt1, coord_t* pt2, double bound) {
+    return sq_distance_bounded_body(pt1, pt2, bound, kernel_dims);
+}
+SPECIALIZED_DIMS(DEFINE_SQ_DISTANCE)
+
+DEFINE_KERNELS(scalar, , kernel_dims, any)
+SPECIALIZED_DIMS(DEFINE_SCALAR_KERNELS)
+
+#ifdef X86_KERNELS
+#define DEFINE_SSE2_KERNELS(DIMS) DEFINE_KERNELS(sse2, TARGET_SSE2, DIMS, DIMS)
+#define DEFINE_AVX2_KERNELS(DIMS) DEFINE_KERNELS(avx2, TARGET_AVX2, DIMS, DIMS)
+#define DEFINE_AVX512_KERNELS(DIMS) DEFINE_KERNELS(avx512, TARGET_AVX512, DIMS, DIMS)
+
+DEFINE_KERNELS(sse2, TARGET_SSE2, kernel_dims, any)
+SPECIALIZED_DIMS(DEFINE_SSE2_KERNELS)
+DEFINE_KERNELS(avx2, TARGET_AVX2, kernel_dims, any)
+SPECIALIZED_DIMS(DEFINE_AVX2_KERNELS)
+DEFINE_KERNELS(avx512, TARGET_AVX512, kernel_dims, any)
+SPECIALIZED_DIMS(DEFINE_AVX512_KERNELS)
+#endif
+
+#define SELECT_SQ_DISTANCE(DIMS) \
+    case DIMS: \
+        point_kernels.sq_distance = sq_distance_##DIMS; \
+        point_kernels.sq_distance_bounded = sq_distance_bounded_##DIMS; \
+        break;
+
+#define SELECT_KERNELS(ISA, DIMS) \
+    case DIMS: \
+        point_kernels.furthest_point = furthest_point_##ISA##_##DIMS; \
+        point_kernels.sq_distances = sq_distances_##ISA##_##DIMS; \
+        point_kernels.projection_parameters = projection_parameters_##ISA##_##DIMS; \
+        break;
+
+#define SELECT_SCALAR_KERNELS(DIMS) SELECT_KERNELS(scalar, DIMS)
+#define SELECT_SSE2_KERNELS(DIMS) SELECT_KERNELS(sse2, DIMS)
+#define SELECT_AVX2_KERNELS(DIMS) SELECT_KERNELS(avx2, DIMS)
+#define SELECT_AVX512_KERNELS(DIMS) SELECT_KERNELS(avx512, DIMS)
+
+// Picks the ISA kernels for n_dims, falling back to the generic variant of the ISA
+#define SELECT_ISA_KERNELS(ISA, SELECT_DIMS) \
+    point_kernels.furthest_point = furthest_point_##ISA##_any; \
+    point_kernels.sq_distances = sq_distances_##ISA##_any; \
+    point_kernels.projection_parameters = projection_parameters_##ISA##_any; \
+    switch(n_dims) { SPECIALIZED_DIMS(SELECT_DIMS) }
+
+/*
+Returns whether the cpu supports the instruction set of the kernels named isa, any other name selecting the scalar ones
+*/
+static int isa_supported(const char* isa) {
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if(strcmp(isa, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f");
+    if(strcmp(isa, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+#endif
+    return 1;
+}
+
+/*
+Returns the name of the widest instruction set supported by the cpu
+*/
+static const char* detect_isa() {
+#ifdef X86_KERNELS
+    if(isa_supported("avx512"))
+        return "avx512";
+    if(isa_supported("avx2"))
+        return "avx2";
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+/*
+Selects the kernels for points with n_dims dimensions.
+An instruction set of POINT_KERNELS the cpu does not support is replaced by the detected one, instead of faulting later
+*/
+void init_point_kernels(int n_dims) {
+    const char* isa = getenv("POINT_KERNELS");
+    if(isa != NULL && !isa_supported(isa)) {
+        fprintf(stderr, "POINT_KERNELS=%s is not supported by this cpu, using %s.\n", isa, detect_isa());
+        isa = NULL;
+    }
+    if(isa == NULL) {
+        isa = detect_isa();
+    }
+
+    kernel_dims = n_dims;
+
+    point_kernels.sq_distance = sq_distance_any;
+    point_kernels.sq_distance_bounded = sq_distance_bounded_any;
+    switch(n_dims) { SPECIALIZED_DIMS(SELECT_SQ_DISTANCE) }
+
+#ifdef X86_KERNELS
+    if(strcmp(isa, "avx512") == 0) {
+        point_kernels.name = "avx512";
+        SELECT_ISA_KERNELS(avx512, SELECT_AVX512_KERNELS)
+        return;
+    }
+    if(strcmp(isa, "avx2") == 0) {
+        point_kernels.name = "avx2";
+        SELECT_ISA_KERNELS(avx2, SELECT_AVX2_KERNELS)
+        return;
+    }
+    if(strcmp(isa, "sse2") == 0) {
+        point_kernels.name = "sse2";
+        SELECT_ISA_KERNELS(sse2, SELECT_SSE2_KERNELS)
+        return;
+    }
+#endif
+    point_kernels.name = "scalar";
+    SELECT_ISA_KERNELS(scalar, SELECT_SCALAR_KERNELS)
+}
@@ -0,0 +1,43 @@
+#ifndef POINT_KERNELS_H
+#define POINT_KERNELS_H
+
+#include "coords.h"
+
+/*
+Kernels for the hot point loops, picked once per run by init_point_kernels.
+There are variants specialized at compile time for the common numbers of dimensions
+and explicitly vectorized variants (SSE2, AVX2, AVX-512) chosen from what the cpu supports.
+The vectorized kernels process several points per vector, each lane adding up the dimensions
+in the same order as the scalar code, so every variant returns exactly the same values.
+Coordinates are widened to double before they are combined, also when they are stored as float.
+*/
+
+struct point_kernels {
+    const char* name;
+
+    // Returns the squared distance between points pt1 and pt2
+    double (*sq_distance)(coord_t* pt1, coord_t* pt2);
+
+    // Same as sq_distance, but may stop adding up the dimensions once the sum exceeds bound,
+    // returning that partial sum. Results that do not exceed bound are exactly those of sq_distance
+    double (*sq_distance_bounded)(coord_t* pt1, coord_t* pt2, double bound);
+
+    // Returns the index of the point in pts furthest away from p (the first one on ties) and places its squared
+    // distance in max_distance. Returns -1 if no point is further than 0 from p
+    long (*furthest_point)(coord_t** pts, long n_points, coord_t* p, double* max_distance);
+
+    // Puts in out the squared distances between p and the n_points points stored one after the other from pts,
+    // the same values sq_distance returns
+    void (*sq_distances)(coord_t* pts, long n_points, coord_t* p, double* out);
+
+    // Puts in out the projection parameters (p - a) . basub of the points in pts
+    void (*projection_parameters)(coord_t** pts, long n_points, coord_t* basub, coord_t* a, double* out);
+};
+
+extern struct point_kernels point_kernels;
+
+// Selects the kernels for points with n_dims dimensions. The POINT_KERNELS environment variable
+// (scalar, sse2, avx2 or avx512) overrides the instruction set detected at runtime when the cpu supports it
+void init_point_kernels(int n_dims);
+
+#endif
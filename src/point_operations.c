@@ -4,35 +4,33 @@
 #include <string.h>
 #include "gen_points.h"
 #include "point_operations.h"
+#include "point_kernels.h"
+#include "coords.h"
 
 extern int n_dims; // number of dimensions of each point
 
 /*
 * Returns the squared distance between points pt1 and pt2
 */
-double distance(double* pt1, double* pt2)
+double distance(coord_t* pt1, coord_t* pt2)
 {
-    double dist = 0.0;
-
-    for(int i = 0; i < n_dims; i++)
-        dist += (pt1[i] - pt2[i]) * (pt1[i] - pt2[i]);
-    return dist;
+    return point_kernels.sq_distance(pt1, pt2);
 }
 
 /*
-* Print point p to stdout
+* Print point p to out
 */
-void print_point(double* p) {
+void print_point(FILE* out, coord_t* p) {
     for(int i = 0; i < n_dims; i++){
-        printf(" %.6f", p[i]);
+        fprintf(out, " %.6f", p[i]);
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
 
 /*
 * Puts in out multiplication of value b by point a
 */
-void mul_scalar(double* a, double b, double* out){
+void mul_scalar(coord_t* a, double b, coord_t* out){
     for(int i = 0; i < n_dims; i++){
         out[i] = a[i] * b;
     }
@@ -41,10 +39,10 @@ void mul_scalar(double* a, double b, double* out){
 /*
 * Returns the dot product of points a and b
 */
-double dot_product(double* a, double* b){
+double dot_product(coord_t* a, coord_t* b){
     double c = 0;
     for(int i = 0; i < n_dims; i++){
-        c += a[i] * b[i];
+        c += (double) a[i] * b[i];
     }
     return c;
 }
@@ -52,7 +50,7 @@ double dot_product(double* a, double* b){
 /*
 * Puts in out the sum of points a and b
 */
-void sum_points(double* a, double* b, double* out){
+void sum_points(coord_t* a, coord_t* b, coord_t* out){
     for(int i = 0; i < n_dims; i++){
         out[i] = a[i] + b[i];
     }
@@ -61,7 +59,7 @@ void sum_points(double* a, double* b, double* out){
 /*
 * Puts in out the difference of points a and b
 */
-void sub_points(double* a, double* b, double* out){
+void sub_points(coord_t* a, coord_t* b, coord_t* out){
     for(int i = 0; i < n_dims; i++){
         out[i] = a[i] - b[i];
     }
@@ -70,7 +68,7 @@ void sub_points(double* a, double* b, double* out){
 /*
 * Copies point p into point copy
 */
-void copy_point(double* p, double* copy) {
+void copy_point(coord_t* p, coord_t* copy) {
     for(int i = 0; i < n_dims; i++){
         copy[i] = p[i];
     }
@@ -79,49 +77,38 @@ void copy_point(double* p, double* copy) {
 /*
 * Copies n_points of list a into list b
 */
-void copy_point_list(double **a, double **b, long n_points) {
+void copy_point_list(coord_t **a, coord_t **b, long n_points) {
     for(long i = 0; i < n_points; i++) {
         copy_point(a[i], b[i]);
     }
 }
 
 /*
-* Puts in out the ortogonal projection of point p onto line starting in a and defined by basub
+* Returns the projection parameter of point p onto line starting in a and defined by basub,
+* the dot product of p - a and basub
 */
-void orthogonal_projection(double* basub, double* a , double* p, double* out, double* ortho_tmp){
+double projection_parameter(coord_t* basub, coord_t* a, coord_t* p, coord_t* ortho_tmp){
     sub_points(p, a, ortho_tmp);
-    double c = dot_product(ortho_tmp,basub);
-    double d = dot_product(basub,basub);
-    double e = c/d;
-    mul_scalar(basub,e, ortho_tmp);
-    sum_points(ortho_tmp, a, out);
+    return dot_product(ortho_tmp, basub);
 }
 
 /*
-* Returns the middle of points a and b
+* Puts in out the ortogonal projection with projection parameter t onto line starting in a and defined by basub,
+* or a itself when basub is null because all the points are equal to a
 */
-void middle_point(double* a, double* b, double* out){
-    for(int i = 0; i < n_dims; i++){
-        out[i] = (a[i] + b[i]) / 2;
-    }
+void projection_point(coord_t* basub, coord_t* a, double t, coord_t* out){
+    double d = dot_product(basub,basub);
+    double e = d > 0 ? t/d : 0;
+    mul_scalar(basub, e, out);
+    sum_points(out, a, out);
 }
 
 /*
-Used for quicksort
-Compares the x coordenate of the two points
+* Returns the middle of points a and b
 */
-int compare_point(const void* pt1, const void* pt2) {
-    double* dpt1 = *((double**) pt1);
-    double* dpt2 = *((double**) pt2);
-
-    if(dpt1[0] > dpt2[0]) {
-        return 1;
-    }
-    else if(dpt1[0] < dpt2[0]) {
-        return -1;
-    }
-    else {
-        return 0;
+void middle_point(coord_t* a, coord_t* b, coord_t* out){
+    for(int i = 0; i < n_dims; i++){
+        out[i] = (a[i] + b[i]) / 2;
     }
 }
 
@@ -1,37 +1,40 @@
 #ifndef POINT_OPERATIONS_H
 #define POINT_OPERATIONS_H
 
-double distance(double* pt1, double* pt2);
+#include <stdio.h>
+#include "coords.h"
 
-// Print point p to stdout
-void print_point(double* p);
+double distance(coord_t* pt1, coord_t* pt2);
+
+// Print point p to out
+void print_point(FILE* out, coord_t* p);
 
 // Puts in out the multiplication of value b by point a
-void mul_scalar(double* a, double b, double* out);
+void mul_scalar(coord_t* a, double b, coord_t* out);
 
 //Returns the dot product of points a and b
-double dot_product(double* a, double* b);
+double dot_product(coord_t* a, coord_t* b);
 
 //Puts in out the sum of points a and b
-void sum_points(double* a, double* b, double* out);
+void sum_points(coord_t* a, coord_t* b, coord_t* out);
 
 //Puts in out the difference of points a and b
-void sub_points(double* a, double* b, double* out);
+void sub_points(coord_t* a, coord_t* b, coord_t* out);
+
+//Returns the projection parameter (p - a) . basub of point p onto line starting in a and defined by basub
+double projection_parameter(coord_t* basub, coord_t* a, coord_t* p, coord_t* ortho_tmp);
 
-//Puts in out the ortogonal projection of point p onto line starting in a and defined by basub
-void orthogonal_projection(double* basub, double* b, double* p, double* out, double* ortho_tmp);
+//Puts in out the ortogonal projection with projection parameter t onto line starting in a and defined by basub
+void projection_point(coord_t* basub, coord_t* a, double t, coord_t* out);
 
 //Returns the middle of points a and b
-void middle_point(double* a, double* b, double* out);
+void middle_point(coord_t* a, coord_t* b, coord_t* out);
 
 //Returns a copy of point p
-void copy_point(double* p, double* out);
+void copy_point(coord_t* p, coord_t* out);
 
 //Copies n_points of list a into list b
-void copy_point_list(double **a, double **b, long n_points);
-
-//Compares the x coordenate of the two points
-int compare_point(const void* pt1, const void* pt2);
+void copy_point_list(coord_t **a, coord_t **b, long n_points);
 
 //Compares a double
 int compare_double(const void* pt1, const void* pt2);
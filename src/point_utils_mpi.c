@@ -16,13 +16,13 @@ extern MPI_Comm communicator;
 Process root broadcast his local point at index i of pts to all other processes.
 That point is copied onto out
 */
-void mpi_broadcast_point(double **pts, long i, int root, double *out) {
+void mpi_broadcast_point(coord_t **pts, long i, int root, coord_t *out) {
     if(rank == root){
         /*send*/
         MPI_Bcast(
                 pts[i],             /*the address of the data the current process is sending*/
                 n_dims,             /*the number of data elements sent*/
-                MPI_DOUBLE,         /*type of data elements sent*/
+                MPI_COORD,          /*type of data elements sent*/
                 root,               /*rank of the process sending the data*/
                 communicator        /*broadcast to all processes in the current team*/
         );
@@ -33,7 +33,7 @@ void mpi_broadcast_point(double **pts, long i, int root, double *out) {
         MPI_Bcast(
                 out,                /*the address of the data the current process is receiving*/
                 n_dims,             /*the number of data elements to receive*/
-                MPI_DOUBLE,         /*type of data elements received*/
+                MPI_COORD,          /*type of data elements received*/
                 root,               /*rank of the process sending the data*/
                 communicator        /*broadcast to all processes in the current team*/
         );
@@ -45,7 +45,7 @@ Get nth point in the global point list pts.
 The distribution of points is given by processes_n_points.
 The nth point is copied to out at all processes
 */
-void mpi_get_point(double **pts, long n, long* processes_n_points, double* out) {
+void mpi_get_point(coord_t **pts, long n, long* processes_n_points, coord_t* out) {
     long count = 0;
     long displacement = 0;
     for(int i = 0; i < n_procs; i++){
@@ -61,6 +61,34 @@ void mpi_get_point(double **pts, long n, long* processes_n_points, double* out)
 }
 
 
+/*
+Returns at all processes the nth value in the global list values.
+The distribution of values is given by processes_n_points.
+*/
+double mpi_get_value(double *values, long n, long* processes_n_points) {
+    long count = 0;
+    double value = 0.0;
+    for(int i = 0; i < n_procs; i++){
+        if(processes_n_points[i] + count > n ){
+            if(rank == i) {
+                value = values[n - count];
+            }
+            MPI_Bcast(
+                    &value,             /*the address of the data sent or received*/
+                    1,                  /*the number of data elements sent*/
+                    MPI_DOUBLE,         /*type of data elements sent*/
+                    i,                  /*rank of the process sending the data*/
+                    communicator        /*broadcast to all processes in the current team*/
+            );
+            break;
+        }
+        else {
+            count += processes_n_points[i];
+        }
+    }
+    return value;
+}
+
 /*
 Puts in out the value of my_count at each process
 */
@@ -1,7 +1,11 @@
 #ifndef POINT_UTILS_MPI_H
 #define POINT_UTILS_MPI_H
 
-void mpi_get_point(double **pts, long n, long* processes_n_points, double* out);
+#include "coords.h"
+
+void mpi_get_point(coord_t **pts, long n, long* processes_n_points, coord_t* out);
+
+double mpi_get_value(double *values, long n, long* processes_n_points);
 
 void mpi_get_processes_counts(long my_count, long *out);
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "points_file.h"
+
+long check_points_file(struct points_file_header* header, long file_size, char* path) {
+    if(file_size < (long) sizeof(*header) || memcmp(header->magic, POINTS_FILE_MAGIC, POINTS_FILE_MAGIC_SIZE)) {
+        printf("Invalid points file '%s'.\n", path);
+        exit(6);
+    }
+    if(header->version != POINTS_FILE_VERSION || header->n_dims < 2 ||
+       (header->coord_size != sizeof(float) && header->coord_size != sizeof(double))) {
+        printf("Points file '%s' has version %d, %ld dimensions and %d byte coordinates, expected version %d and at least 2 dimensions.\n",
+               path, header->version, (long) header->n_dims, header->coord_size, POINTS_FILE_VERSION);
+        exit(6);
+    }
+
+    long point_size = header->n_dims * header->coord_size;
+    long n_stored = (file_size - (long) sizeof(*header)) / point_size;
+    long n_points = header->n_points < 0 ? n_stored : header->n_points;
+    if(n_points > n_stored) {
+        printf("Points file '%s' holds %ld points, its header gives %ld.\n", path, n_stored, n_points);
+        exit(6);
+    }
+    if(n_points < 1) {
+        printf("Points file '%s' has no points.\n", path);
+        exit(6);
+    }
+    return n_points;
+}
+
+void convert_coords(coord_t* out, void* values, long n_values, int coord_size) {
+    if(coord_size == sizeof(float)) {
+        for(long i = 0; i < n_values; i++) {
+            out[i] = ((float*) values)[i];
+        }
+    }
+    else {
+        for(long i = 0; i < n_values; i++) {
+            out[i] = ((double*) values)[i];
+        }
+    }
+}
+
+int open_points_file(char* path, struct points_file_header* header, long* n_points) {
+    struct stat file_stat;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &file_stat) < 0) {
+        printf("Cannot open points file '%s'.\n", path);
+        exit(2);
+    }
+    memset(header, 0, sizeof(*header));
+    if(pread(fd, header, sizeof(*header), 0) < 0) {
+        printf("Cannot read points file '%s'.\n", path);
+        exit(2);
+    }
+    *n_points = check_points_file(header, file_stat.st_size, path);
+    return fd;
+}
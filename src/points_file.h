@@ -0,0 +1,22 @@
+#ifndef POINTS_FILE_H
+#define POINTS_FILE_H
+
+#include "coords.h"
+#include "points_format.h"
+
+/*
+Reading of the binary points files (see points_format.h) the builders take with --input instead of generating the points
+*/
+
+//Checks that header, the first bytes of the file at path of file_size bytes, starts a points file the builders can read,
+//exiting otherwise, and returns its number of points
+long check_points_file(struct points_file_header* header, long file_size, char* path);
+
+//Opens the points file at path and reads its header, exiting if it is not a points file the builders can read.
+//Returns the file descriptor and places the number of points in n_points
+int open_points_file(char* path, struct points_file_header* header, long* n_points);
+
+//Writes in out the n_values coordinates of coord_size bytes at values, converted to coord_t
+void convert_coords(coord_t* out, void* values, long n_values, int coord_size);
+
+#endif
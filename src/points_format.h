@@ -0,0 +1,25 @@
+#ifndef POINTS_FORMAT_H
+#define POINTS_FORMAT_H
+
+#include <stdint.h>
+
+/*
+Binary points file, used for the query points of ballQuery in batch mode.
+The file holds, in the byte order of the machine that wrote it, a points_file_header followed by
+the points one after the other, each with n_dims coordinates of coord_size bytes.
+n_points is -1 when the writer did not know it beforehand, and then the points go until the end of the file.
+*/
+
+#define POINTS_FILE_MAGIC "BALLPNTS" // first bytes of every binary points file
+#define POINTS_FILE_MAGIC_SIZE 8
+#define POINTS_FILE_VERSION 1
+
+struct points_file_header {
+    char magic[POINTS_FILE_MAGIC_SIZE]; // POINTS_FILE_MAGIC, not null terminated
+    int32_t version; // POINTS_FILE_VERSION of the writer
+    int32_t coord_size; // bytes of each coordinate, 8 for double and 4 for float
+    int64_t n_dims; // number of dimensions of the points
+    int64_t n_points; // number of points, or -1 if they go until the end of the file
+};
+
+#endif
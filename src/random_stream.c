@@ -0,0 +1,124 @@
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "macros.h"
+#include "random_stream.h"
+
+#define RANDOM_DISCARDED (10 * RANDOM_DEGREE) // values srandom draws and throws away after seeding
+
+/*
+Writes in value the state in the order it was generated, oldest first. The value generated next is
+value[0] + value[RANDOM_DEGREE - RANDOM_SEPARATION]
+*/
+static void stream_window(random_stream_t* stream, uint32_t* value) {
+    for(int i = 0; i < RANDOM_DEGREE; i++) {
+        value[i] = stream->state[(stream->front + i) % RANDOM_DEGREE];
+    }
+}
+
+void random_stream_seed(random_stream_t* stream, unsigned seed) {
+    // glibc's srandom_r: a Park-Miller sequence computed with Schrage's method to stay within 31 bits
+    if(seed == 0) {
+        seed = 1;
+    }
+    int32_t word = seed;
+    stream->state[0] = seed;
+    for(int i = 1; i < RANDOM_DEGREE; i++) {
+        long hi = word / 127773;
+        long lo = word % 127773;
+        word = 16807 * lo - 2836 * hi;
+        if(word < 0) {
+            word += 2147483647;
+        }
+        stream->state[i] = word;
+    }
+    stream->front = RANDOM_SEPARATION;
+    stream->rear = 0;
+    for(int i = 0; i < RANDOM_DISCARDED; i++) {
+        random_stream_next(stream);
+    }
+}
+
+long random_stream_next(random_stream_t* stream) {
+    uint32_t value = stream->state[stream->front] += stream->state[stream->rear];
+    if(++stream->front == RANDOM_DEGREE) {
+        stream->front = 0;
+    }
+    if(++stream->rear == RANDOM_DEGREE) {
+        stream->rear = 0;
+    }
+    return value >> 1;
+}
+
+/*
+Multiplies polynomial a by b modulo x^31 - x^28 - 1, with coefficients modulo 2^32, placing the result in a.
+The generated values follow v[n] = v[n - 31] + v[n - 3], so x^n modulo that polynomial gives the weights
+of the current window in the value n steps ahead
+*/
+static void multiply_modulo(uint32_t* a, uint32_t* b) {
+    uint32_t product[2 * RANDOM_DEGREE - 1];
+    memset(product, 0, sizeof(product));
+    for(int i = 0; i < RANDOM_DEGREE; i++) {
+        for(int j = 0; j < RANDOM_DEGREE; j++) {
+            product[i + j] += a[i] * b[j];
+        }
+    }
+    for(int k = 2 * RANDOM_DEGREE - 2; k >= RANDOM_DEGREE; k--) {
+        product[k - RANDOM_SEPARATION] += product[k];
+        product[k - RANDOM_DEGREE] += product[k];
+    }
+    memcpy(a, product, RANDOM_DEGREE * sizeof(uint32_t));
+}
+
+/*
+Multiplies polynomial a by x modulo x^31 - x^28 - 1
+*/
+static void shift_modulo(uint32_t* a) {
+    uint32_t top = a[RANDOM_DEGREE - 1];
+    memmove(a + 1, a, (RANDOM_DEGREE - 1) * sizeof(uint32_t));
+    a[0] = top;
+    a[RANDOM_DEGREE - RANDOM_SEPARATION] += top;
+}
+
+void random_stream_skip(random_stream_t* stream, long n) {
+    uint32_t power[RANDOM_DEGREE] = { 1 }; // x^n
+    uint32_t square[RANDOM_DEGREE] = { 0, 1 }; // x^(2^bit)
+    for(; n > 0; n >>= 1) {
+        if(n & 1) {
+            multiply_modulo(power, square);
+        }
+        if(n > 1) {
+            uint32_t copy[RANDOM_DEGREE];
+            memcpy(copy, square, sizeof(copy));
+            multiply_modulo(square, copy);
+        }
+    }
+
+    uint32_t window[RANDOM_DEGREE];
+    stream_window(stream, window);
+    for(int i = 0; i < RANDOM_DEGREE; i++) {
+        uint32_t value = 0;
+        for(int j = 0; j < RANDOM_DEGREE; j++) {
+            value += power[j] * window[j];
+        }
+        stream->state[(stream->front + i) % RANDOM_DEGREE] = value;
+        shift_modulo(power);
+    }
+}
+
+void random_fill(coord_t* values, long n_values, unsigned seed, long skip, double range) {
+    #pragma omp parallel
+    {
+        int n_threads = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        long low = BLOCK_LOW(thread, n_threads, n_values);
+        long high = BLOCK_LOW(thread + 1, n_threads, n_values);
+
+        random_stream_t stream;
+        random_stream_seed(&stream, seed);
+        random_stream_skip(&stream, skip + low);
+        for(long i = low; i < high; i++) {
+            values[i] = range * ((double) random_stream_next(&stream)) / RAND_MAX;
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef RANDOM_STREAM_H
+#define RANDOM_STREAM_H
+
+#include <stdint.h>
+#include "coords.h"
+
+/*
+The TYPE_3 additive feedback generator glibc uses for random(), reimplemented so that the generated points
+stay the same while a stream can jump ahead in logarithmic time instead of drawing every number it skips.
+A stream seeded with random_stream_seed(seed) returns from random_stream_next exactly what random()
+returns after srandom(seed).
+*/
+
+#define RANDOM_DEGREE 31 // number of values in the state
+#define RANDOM_SEPARATION 3 // distance between the two state values added together
+
+typedef struct random_stream {
+    uint32_t state[RANDOM_DEGREE];
+    int front; // position of the value added to the one at rear and replaced by the sum
+    int rear;
+} random_stream_t;
+
+// Same as srandom(seed)
+void random_stream_seed(random_stream_t* stream, unsigned seed);
+
+// Same as random()
+long random_stream_next(random_stream_t* stream);
+
+// Advances the stream as n calls to random_stream_next would, in O(log n)
+void random_stream_skip(random_stream_t* stream, long n);
+
+// Fills values[0 .. n_values - 1] with range * random() / RAND_MAX, for the random() values that come after the first
+// skip ones of seed, splitting the values among the OpenMP threads
+void random_fill(coord_t* values, long n_values, unsigned seed, long skip, double range);
+
+#endif
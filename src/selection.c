@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include "point_operations.h"
+#include "selection.h"
+
+#define SELECT_INSERTION_THRESHOLD 16  // ranges at most this size are finished with an insertion sort
+
+static inline void swap_doubles(double *values, long i, long j) {
+    double tmp = values[i];
+    values[i] = values[j];
+    values[j] = tmp;
+}
+
+/*
+Sorts values[low..high]. Used for the small ranges left at the end of the selection
+*/
+static void insertion_sort_doubles(double *values, long low, long high) {
+    for(long i = low + 1; i <= high; i++) {
+        double v = values[i];
+        long j = i - 1;
+        while(j >= low && values[j] > v) {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = v;
+    }
+}
+
+/*
+Returns the floor of log2(n)
+*/
+static int floor_log2(long n) {
+    int log = 0;
+    while(n >>= 1) {
+        log++;
+    }
+    return log;
+}
+
+/*
+Introselect: quickselect with median of three pivots that falls back to sorting the remaining range
+once 2 * log2(n) partitioning rounds were not enough, so the worst case stays O(n log n).
+On return values[k] holds the k-th smallest value, every value before it
+is smaller or equal and every value after it is greater or equal
+*/
+void select_double(double *values, long n, long k) {
+    long low = 0;
+    long high = n - 1;
+    int depth_limit = 2 * floor_log2(n);
+
+    while(high - low > SELECT_INSERTION_THRESHOLD) {
+        if(depth_limit-- == 0) {
+            qsort(values + low, high - low + 1, sizeof(double), compare_double);
+            return;
+        }
+
+        /* median of three, also leaves sentinels at both ends of the range */
+        long middle = low + (high - low) / 2;
+        if(values[middle] < values[low]) swap_doubles(values, middle, low);
+        if(values[high] < values[low]) swap_doubles(values, high, low);
+        if(values[high] < values[middle]) swap_doubles(values, high, middle);
+        double pivot = values[middle];
+
+        long i = low;
+        long j = high;
+        while(i <= j) {
+            while(values[i] < pivot) i++;
+            while(values[j] > pivot) j--;
+            if(i <= j) {
+                swap_doubles(values, i, j);
+                i++;
+                j--;
+            }
+        }
+
+        /* values[low..j] <= pivot, values[j+1..i-1] == pivot, values[i..high] >= pivot */
+        if(k <= j) {
+            high = j;
+        }
+        else if(k >= i) {
+            low = i;
+        }
+        else {
+            return;
+        }
+    }
+    insertion_sort_doubles(values, low, high);
+}
+
+/*
+Three way partition of values around pivot: on return values[0..n_less) < pivot,
+values[n_less..n_less + n_equal) == pivot and the remaining values > pivot
+*/
+void partition_doubles(double *values, long n, double pivot, long *n_less, long *n_equal) {
+    long low = 0;
+    long i = 0;
+    long high = n;
+    while(i < high) {
+        if(values[i] < pivot) {
+            swap_doubles(values, low, i);
+            low++;
+            i++;
+        }
+        else if(values[i] > pivot) {
+            high--;
+            swap_doubles(values, i, high);
+        }
+        else {
+            i++;
+        }
+    }
+    *n_less = low;
+    *n_equal = high - low;
+}
+
+/*
+Places in first and second the ((n - 1) / 2)-th and (n / 2)-th smallest values.
+Both middles are found with a single selection: once the upper middle is in place
+the lower one is the largest value on its left.
+Reorders values
+*/
+void select_median_doubles(double *values, long n, double *first, double *second) {
+    long k = n / 2;
+    select_double(values, n, k);
+    *second = values[k];
+
+    if(n % 2) { // is odd
+        *first = values[k];
+        return;
+    }
+
+    double max = values[0];
+    for(long i = 1; i < k; i++) {
+        if(values[i] > max) {
+            max = values[i];
+        }
+    }
+    *first = max;
+}
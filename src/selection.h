@@ -0,0 +1,13 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+//Reorders values so that values[k] holds the k-th smallest value
+void select_double(double *values, long n, long k);
+
+//Three way partition of values into values smaller, equal and greater than pivot
+void partition_doubles(double *values, long n, double pivot, long *n_less, long *n_equal);
+
+//Places in first and second the two middle values of values (the same value if n is odd)
+void select_median_doubles(double *values, long n, double *first, double *second);
+
+#endif
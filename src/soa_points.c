@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include "soa_points.h"
+#include "parallel_operations.h"
+#include "macros.h"
+
+#define CACHE_LINE 64 // bytes in a cache line, the alignment of the rows of each dimension
+#define STRIDE_MULTIPLE (CACHE_LINE / sizeof(coord_t)) // the stride is rounded up to a whole number of cache lines
+#define SOA_BLOCK 256 // points whose distances are accumulated together, small enough for the sums to stay in L1
+#define CHUNKS_PER_THREAD 4 // chunks each scan is split in per thread, to balance chunks that finish at different times
+
+// The loops over consecutive points are vectorized by the compiler for the widest vectors the cpu supports
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define TARGET_CLONES
+#endif
+
+extern int n_dims; // number of dimensions of each point
+
+/*
+Returns the number of chunks a scan over n_points points is split in
+*/
+static long get_n_chunks(long n_points) {
+    if(!USE_PARALLEL_SCANS(n_points)) {
+        return 1;
+    }
+    long n_chunks = omp_get_num_threads() * CHUNKS_PER_THREAD;
+    return MIN(n_chunks, n_points);
+}
+
+/*
+Allocates room for n_points points of n_dims dimensions, with the row of each dimension starting at a cache line
+*/
+soa_t create_soa_points(int n_dims, long n_points) {
+    soa_t pts;
+    pts.stride = (n_points + STRIDE_MULTIPLE - 1) / STRIDE_MULTIPLE * STRIDE_MULTIPLE;
+    pts.data = (coord_t*) aligned_alloc(CACHE_LINE, sizeof(coord_t) * n_dims * pts.stride);
+    if(pts.data == NULL) {
+        printf("Error allocating array of points, exiting.\n");
+        exit(4);
+    }
+    return pts;
+}
+
+void free_soa_points(soa_t pts) {
+    free(pts.data);
+}
+
+/*
+Returns the partition of n_points points whose region starts after the region of the first low points of pts
+*/
+soa_t soa_partition(soa_t pts, long low, long n_points) {
+    soa_t partition;
+    partition.data = pts.data + low * n_dims;
+    partition.stride = n_points;
+    return partition;
+}
+
+/*
+Copies the points of the array of points pts to out, transposing blocks of SOA_BLOCK points at a time
+*/
+void soa_from_array_pts(coord_t** pts, long n_points, soa_t out) {
+    for(long block = 0; block < n_points; block += SOA_BLOCK) {
+        long size = MIN(SOA_BLOCK, n_points - block);
+        for(int d = 0; d < n_dims; d++) {
+            coord_t* row = out.data + d * out.stride + block;
+            for(long j = 0; j < size; j++) {
+                row[j] = pts[block + j][d];
+            }
+        }
+    }
+}
+
+void soa_to_array_pts(soa_t pts, long n_points, coord_t** out) {
+    for(int d = 0; d < n_dims; d++) {
+        coord_t* row = pts.data + d * pts.stride;
+        for(long i = 0; i < n_points; i++) {
+            out[i][d] = row[i];
+        }
+    }
+}
+
+void soa_get_point(soa_t pts, long i, coord_t* out) {
+    for(int d = 0; d < n_dims; d++) {
+        out[d] = pts.data[d * pts.stride + i];
+    }
+}
+
+/*
+Serial scan for the furthest point of soa_furthest_point.
+The squared distances of a block of points are accumulated one dimension at a time
+*/
+TARGET_CLONES static long furthest_point_range(soa_t pts, long low, long high, coord_t* p, double* max_distance) {
+    double distances[SOA_BLOCK];
+    double max = 0.0;
+    long furthest = -1;
+
+    for(long block = low; block < high; block += SOA_BLOCK) {
+        long size = MIN(SOA_BLOCK, high - block);
+        for(long j = 0; j < size; j++) {
+            distances[j] = 0.0;
+        }
+        for(int d = 0; d < n_dims; d++) {
+            coord_t* row = pts.data + d * pts.stride + block;
+            double coord = p[d];
+            for(long j = 0; j < size; j++) {
+                double diff = coord - row[j];
+                distances[j] += diff * diff;
+            }
+        }
+        for(long j = 0; j < size; j++) {
+            if(distances[j] > max) {
+                max = distances[j];
+                furthest = block + j;
+            }
+        }
+    }
+    *max_distance = max;
+    return furthest;
+}
+
+/*
+Returns the index of the point in pts furthest away from p.
+Chunks are combined in order, so on ties the point with the lowest index is returned
+*/
+long soa_furthest_point(soa_t pts, long n_points, coord_t* p, double* max_distance) {
+    long n_chunks = get_n_chunks(n_points);
+    if(n_chunks == 1) {
+        return furthest_point_range(pts, 0, n_points, p, max_distance);
+    }
+    double chunk_max_distance[n_chunks];
+    long chunk_furthest[n_chunks];
+
+    #pragma omp taskloop grainsize(1) shared(chunk_max_distance, chunk_furthest)
+    for(long c = 0; c < n_chunks; c++) {
+        chunk_furthest[c] = furthest_point_range(pts, BLOCK_LOW(c, n_chunks, n_points), BLOCK_HIGH(c, n_chunks, n_points) + 1, p, &chunk_max_distance[c]);
+    }
+
+    double max = 0.0;
+    long furthest = -1;
+    for(long c = 0; c < n_chunks; c++) {
+        if(chunk_max_distance[c] > max) {
+            max = chunk_max_distance[c];
+            furthest = chunk_furthest[c];
+        }
+    }
+    *max_distance = max;
+    return furthest;
+}
+
+/*
+Serial scan for soa_projection_parameters, accumulating out one dimension at a time
+*/
+TARGET_CLONES static void projection_parameters_range(soa_t pts, long low, long high, coord_t* basub, coord_t* a, double* out) {
+    for(long i = low; i < high; i++) {
+        out[i] = 0.0;
+    }
+    for(int d = 0; d < n_dims; d++) {
+        coord_t* row = pts.data + d * pts.stride;
+        double coord = a[d];
+        double direction = basub[d];
+        for(long i = low; i < high; i++) {
+            out[i] += (row[i] - coord) * direction;
+        }
+    }
+}
+
+/*
+Puts in out the projection parameters of the points in pts onto line starting in a and defined by basub.
+*/
+void soa_projection_parameters(soa_t pts, long n_points, coord_t* basub, coord_t* a, double* out) {
+    long n_chunks = get_n_chunks(n_points);
+    if(n_chunks == 1) {
+        projection_parameters_range(pts, 0, n_points, basub, a, out);
+        return;
+    }
+
+    #pragma omp taskloop grainsize(1)
+    for(long c = 0; c < n_chunks; c++) {
+        projection_parameters_range(pts, BLOCK_LOW(c, n_chunks, n_points), BLOCK_HIGH(c, n_chunks, n_points) + 1, basub, a, out);
+    }
+}
+
+/*
+Copies the points of pts in [low, high[ to left from index l and right from index r.
+The points smaller than split and the first ties points equal to split go to left.
+The destination of each point of a block is found once and then the block is copied one dimension at a time
+*/
+TARGET_CLONES static void fill_partitions_range(soa_t pts, long low, long high, double* ortho_array, soa_t left, long l, soa_t right, long r, double split, long ties) {
+    char is_left[SOA_BLOCK];
+    long destination[SOA_BLOCK];
+
+    for(long block = low; block < high; block += SOA_BLOCK) {
+        long size = MIN(SOA_BLOCK, high - block);
+        for(long j = 0; j < size; j++) {
+            int tie = ortho_array[block + j] == split && ties > 0;
+            ties -= tie;
+            is_left[j] = ortho_array[block + j] < split || tie;
+            destination[j] = is_left[j] ? l : r;
+            l += is_left[j];
+            r += !is_left[j];
+        }
+        for(int d = 0; d < n_dims; d++) {
+            coord_t* row = pts.data + d * pts.stride + block;
+            coord_t* left_row = left.data + d * left.stride;
+            coord_t* right_row = right.data + d * right.stride;
+            for(long j = 0; j < size; j++) {
+                coord_t* partition_row = is_left[j] ? left_row : right_row;
+                partition_row[destination[j]] = row[j];
+            }
+        }
+    }
+}
+
+/*
+Copies the n_points_left points in pts with the smallest projection parameters to left and the others to right,
+the points equal to split filling left in order like in fill_partitions.
+Chunks get their offsets in left and right from parallel_partition_offsets
+*/
+void soa_fill_partitions(soa_t pts, long n_points, double* ortho_array, soa_t left, soa_t right, double split, long n_points_left) {
+    long n_chunks = get_n_chunks(n_points);
+    if(n_chunks == 1) {
+        long ties = n_points_left;
+        for(long i = 0; i < n_points; i++) {
+            ties -= ortho_array[i] < split;
+        }
+        fill_partitions_range(pts, 0, n_points, ortho_array, left, 0, right, 0, split, ties);
+        return;
+    }
+    long chunk_left_offset[n_chunks];
+    long chunk_right_offset[n_chunks];
+    long chunk_ties[n_chunks];
+    parallel_partition_offsets(ortho_array, n_points, n_chunks, split, n_points_left, chunk_left_offset, chunk_right_offset, chunk_ties);
+
+    #pragma omp taskloop grainsize(1) shared(chunk_left_offset, chunk_right_offset, chunk_ties)
+    for(long c = 0; c < n_chunks; c++) {
+        fill_partitions_range(pts, BLOCK_LOW(c, n_chunks, n_points), BLOCK_HIGH(c, n_chunks, n_points) + 1, ortho_array,
+                              left, chunk_left_offset[c], right, chunk_right_offset[c], split, chunk_ties[c]);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef SOA_POINTS_H
+#define SOA_POINTS_H
+
+#include "coords.h"
+
+/*
+Points stored dimension major (structure of arrays): coordinate d of point i is data[d * stride + i].
+The scans of the builders then read each dimension as a contiguous stream, which vectorizes
+over consecutive points for any number of dimensions.
+Rows start at cache line boundaries in the allocated buffers. The partitions of a set of points are stored
+compactly one after the other in its region of the buffer (soa_partition), with the stride of each partition
+being its number of points, so the points of every subtree stay together down to the leaves.
+The kernels add up the dimensions in the same order as the point kernels, so they return the same values.
+Large scans are split among the OpenMP threads like the ones in parallel_operations,
+so they must be called by one thread of a parallel region.
+*/
+
+typedef struct soa_points {
+    coord_t* data; // coordinate d of point i is data[d * stride + i]
+    long stride; // distance between consecutive dimensions of a point
+} soa_t;
+
+//Allocates room for n_points points of n_dims dimensions
+soa_t create_soa_points(int n_dims, long n_points);
+
+//Frees the buffer of points allocated by create_soa_points
+void free_soa_points(soa_t pts);
+
+//Returns the partition of n_points points stored compactly in the region of pts after the first low points
+soa_t soa_partition(soa_t pts, long low, long n_points);
+
+//Copies the n_points points of the array of points pts to out
+void soa_from_array_pts(coord_t** pts, long n_points, soa_t out);
+
+//Copies the n_points points of pts to the array of points out
+void soa_to_array_pts(soa_t pts, long n_points, coord_t** out);
+
+//Copies point i of pts to out
+void soa_get_point(soa_t pts, long i, coord_t* out);
+
+//Returns the index of the point in pts furthest away from p (the first one on ties) and places its squared
+//distance in max_distance. Returns -1 if no point is further than 0 from p
+long soa_furthest_point(soa_t pts, long n_points, coord_t* p, double* max_distance);
+
+//Puts in out the projection parameters (p - a) . basub of the points in pts
+void soa_projection_parameters(soa_t pts, long n_points, coord_t* basub, coord_t* a, double* out);
+
+//Copies the n_points_left points in pts with the smallest projection parameters to left and the others to right, keeping their order
+void soa_fill_partitions(soa_t pts, long n_points, double* ortho_array, soa_t left, soa_t right, double split, long n_points_left);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef TREE_FORMAT_H
+#define TREE_FORMAT_H
+
+#include <stdint.h>
+
+/*
+Binary ball tree file, written by the builders with --format binary and mapped by ballQuery.
+The file holds, in the byte order of the machine that wrote it:
+  - a tree_file_header
+  - n_nodes tree_file_node records
+  - n_nodes centers of n_dims coordinates of coord_size bytes each, center i belonging to record i
+  - in trees built with --leaf-size above 1 (TREE_FILE_BUCKETS_VERSION), the points of the leaves, one after the
+    other, each leaf holding -left_id points from point right_id on
+Every part starts at a multiple of 8 bytes, so the records, the centers and the points can be used in place.
+The version is increased whenever the layout changes.
+*/
+
+#define TREE_FILE_MAGIC "BALLTREE" // first bytes of every binary tree file
+#define TREE_FILE_MAGIC_SIZE 8
+#define TREE_FILE_VERSION 1
+#define TREE_FILE_BUCKETS_VERSION 2 // version of the files of trees with bucket leaves, which have a points part
+
+struct tree_file_header {
+    char magic[TREE_FILE_MAGIC_SIZE]; // TREE_FILE_MAGIC, not null terminated
+    int32_t version; // TREE_FILE_VERSION of the writer
+    int32_t coord_size; // bytes of each coordinate, 8 for double and 4 for float builds
+    int64_t n_dims; // number of dimensions of the centers
+    int64_t n_nodes; // number of node records and centers
+};
+
+struct tree_file_node {
+    int64_t id; // id of the node, the root is 0
+    int64_t left_id; // id of the left child, -1 for leaves, minus the number of points of leaves of bucket trees
+    int64_t right_id; // id of the right child, -1 for leaves, the first point of leaves of bucket trees
+    double radius; // radius of the node, 0 for leaves of a single point
+};
+
+// Offset of the first node record and of the first center in a binary tree file
+#define TREE_FILE_NODES_OFFSET ((int64_t) sizeof(struct tree_file_header))
+#define TREE_FILE_CENTERS_OFFSET(N_NODES) (TREE_FILE_NODES_OFFSET + (N_NODES) * (int64_t) sizeof(struct tree_file_node))
+
+// Offset of the first point of the leaves in a binary tree file of a bucket tree
+#define TREE_FILE_POINTS_OFFSET(N_NODES, N_DIMS, COORD_SIZE) \
+    ((TREE_FILE_CENTERS_OFFSET(N_NODES) + (N_NODES) * (N_DIMS) * (int64_t) (COORD_SIZE) + 7) / 8 * 8)
+
+#endif